@@ -0,0 +1,446 @@
+/*
+ * Copyright (c) 2013-2020 jkbenaim et al.
+ *
+ * This program is free software; you may redistribute and/or modify it under
+ * the terms of the expat license (also known as the "MIT license").
+ *
+ * This program is distributed in the hope that it will be useful, but without
+ * any warranty; without even the implied warranty of merchantability or
+ * firness for a particular purpose.
+ *
+ * For the full license text, see LICENSE.
+ *
+ ******************************************************************************
+ *
+ * This file implements the benchmarks, run with 'make bench'. The saves and
+ * roms they use are synthetic, made up here from a fixed seed.
+ *
+ */
+
+#include "err_shim.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "frame.h"
+#include "gbcam.h"
+#include "imgenc.h"
+#include "pngenc.h"
+#include "sram.h"
+#include "tile.h"
+#include "wingetopt.h"
+
+#define PROGNAME "gbcambench"
+#define NUM_SAVES 4
+#define MAX_RESULTS 64
+
+static uint8_t saves[NUM_SAVES][GBCAM_SAVE_SIZE];
+static uint8_t rom[GBCAM_ROM_SIZE], hkRom[GBCAM_ROM_SIZE];
+static double minSeconds = 0.25;
+
+static struct {
+	char name[32];
+	double value;
+	const char *unit;
+} results[MAX_RESULTS];
+static int numResults;
+
+static uint32_t rngState;
+
+static uint32_t rng(void)
+{
+	// xorshift32; the same seed always makes the same data.
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState;
+}
+
+// Photos are smooth gradients with a little noise, which compress about
+// as well as real ones. Some slots are deleted, and some are blank.
+static void makeSave(uint8_t *save, uint32_t seed)
+{
+	struct firstslot_s *firstslot = (struct firstslot_s *)save;
+	int order[30];
+
+	rngState = seed;
+	memset(save, 0, GBCAM_SAVE_SIZE);
+	for (int slot = 1; slot <= 30; ++slot) {
+		uint8_t *base = save + (slot + 1) * 0x1000;
+		int fx = rng() % 64 + 16, fy = rng() % 64 + 16;
+
+		if (slot % 11 == 0)
+			continue;
+		for (int y = 0; y < 112; ++y)
+			for (int x = 0; x < 128; ++x) {
+				int shade = ((x * fx / 64 + y * fy / 64) / 24 + (rng() % 5 == 0)) & 3;
+				uint8_t *row = base + (y / 8) * 256 + (x / 8) * 16 + (y % 8) * 2;
+				row[0] |= (shade & 1) << (7 - x % 8);
+				row[1] |= (shade >> 1) << (7 - x % 8);
+			}
+		base[0xfb0] = rng() % 18;
+	}
+	for (int i = 0; i < 30; ++i)
+		order[i] = i;
+	for (int i = 29; i > 0; --i) {
+		int j = rng() % (i + 1), t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+	for (int i = 0; i < 30; ++i)
+		firstslot->vec[i] = (i % 6 == 5) ? 255 : order[i];
+	memcpy(save + 0x11d0, "Magic", 5);
+}
+
+// Frame data is a repeating tile pattern; only the header has to be real.
+static void makeRom(uint8_t *r, bool hk)
+{
+	static const uint8_t logo[4] = {0xce, 0xed, 0x66, 0x66};
+
+	for (size_t i = 0; i < GBCAM_ROM_SIZE; ++i)
+		r[i] = (i * 7) ^ (i >> 5) ^ (i >> 11);
+	memcpy(r + 0x104, logo, sizeof(logo));
+	memcpy(r + 0x134, hk ? "POCKETCAMERA_SN" : "GAMEBOYCAMERA  ", 15);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs fn with growing iteration counts until it takes minSeconds, and
+// returns the seconds per iteration.
+static double timeLoop(void (*fn)(void *ctx, long n), void *ctx)
+{
+	double t, elapsed;
+	long n = 1;
+
+	fn(ctx, 1);
+	for (;;) {
+		t = now();
+		fn(ctx, n);
+		elapsed = now() - t;
+		if (elapsed >= minSeconds)
+			return elapsed / n;
+		n = elapsed > minSeconds / 100 ? (long)(n * minSeconds * 1.2 / elapsed) + 1 : n * 10;
+	}
+}
+
+static void report(const char *name, double value, const char *unit)
+{
+	if (numResults == MAX_RESULTS)
+		errx(1, "too many results");
+	snprintf(results[numResults].name, sizeof(results[0].name), "%s", name);
+	results[numResults].value = value;
+	results[numResults].unit = unit;
+	numResults++;
+}
+
+static volatile unsigned int sink;
+
+static void benchInterleave(void *ctx, long n)
+{
+	unsigned int acc = 0;
+	for (long i = 0; i < n; ++i)
+		acc += interleaveBytes(i, i >> 8);
+	sink = acc;
+}
+
+static void benchTiles(void *ctx, long n)
+{
+	uint8_t *buf = ctx;
+	const uint8_t *tiles = saves[0] + 0x2000;
+	for (long i = 0; i < n; ++i)
+		decodeTile(buf + (i % 16) * 2, GBCAM_STRIDE, tiles + (i % 224) * 16);
+}
+
+struct DecodeCtx_s {
+	struct GbCam_Save_s save;
+	struct GbCam_Rom_s *frames;
+	uint8_t image[GBCAM_IMAGE_SIZE];
+};
+
+static void benchDecode(void *ctx, long n)
+{
+	struct DecodeCtx_s *d = ctx;
+	for (long i = 0; i < n; ++i)
+		GbCam_DecodeSlot(&d->save, d->frames, i % 30 + 1, d->image, sizeof(d->image));
+}
+
+struct FramesCtx_s {
+	const uint8_t *rom;
+	uint8_t *storage;
+};
+
+// Cold frame drawing: a fresh cache each time, with every frame drawn.
+static void benchFrames(void *ctx, long n)
+{
+	struct FramesCtx_s *f = ctx;
+	struct FrameCache_s c;
+
+	for (long i = 0; i < n; ++i) {
+		FrameCache_InitStorage(&c, f->rom, f->storage);
+		for (int frame = 0; frame < c.numFrames; ++frame)
+			FrameCache_Get(&c, frame);
+		FrameCache_Free(&c);
+	}
+}
+
+struct EncodeCtx_s {
+	struct ImageEncoder_s enc;
+	uint8_t images[30][GBCAM_IMAGE_SIZE];
+	size_t bytes;
+};
+
+static void benchEncode(void *ctx, long n)
+{
+	struct EncodeCtx_s *e = ctx;
+	for (long i = 0; i < n; ++i) {
+		if (!ImageEncoder_Encode(&e->enc, e->images[i % 30], GBCAM_WIDTH, GBCAM_HEIGHT, GBCAM_STRIDE))
+			errx(1, "encoding failed");
+		e->bytes += e->enc.outLen;
+	}
+}
+
+// End to end: each thread decodes and encodes whole saves until the time
+// is up.
+static struct {
+	struct GbCam_Rom_s *frames;
+	enum PngProfile_e profile;
+	double deadline;
+	pthread_mutex_t lock;
+	long saves;
+} throughput = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static void *throughputWorker(void *arg)
+{
+	static __thread uint8_t image[GBCAM_IMAGE_SIZE];
+	struct PngEncoder_s enc;
+	struct GbCam_Save_s save;
+	long done = 0;
+
+	PngEncoder_Init(&enc);
+	enc.profile = throughput.profile;
+	while (now() < throughput.deadline) {
+		GbCam_OpenSave(&save, saves[done % NUM_SAVES], GBCAM_SAVE_SIZE);
+		for (int slot = 1; slot <= 30; ++slot) {
+			GbCam_DecodeSlot(&save, throughput.frames, slot, image, sizeof(image));
+			if (!PngEncoder_Encode(&enc, image, GBCAM_WIDTH, GBCAM_HEIGHT, GBCAM_STRIDE))
+				errx(1, "encoding failed");
+		}
+		done++;
+	}
+	PngEncoder_Free(&enc);
+
+	pthread_mutex_lock(&throughput.lock);
+	throughput.saves += done;
+	pthread_mutex_unlock(&throughput.lock);
+	return NULL;
+}
+
+static double savesPerSecond(struct GbCam_Rom_s *frames, int numThreads, enum PngProfile_e profile)
+{
+	pthread_t threads[numThreads];
+	double t = now();
+
+	throughput.frames = frames;
+	throughput.profile = profile;
+	throughput.saves = 0;
+	throughput.deadline = t + minSeconds * 4;
+	for (int i = 0; i < numThreads; ++i)
+		if ((errno = pthread_create(&threads[i], NULL, throughputWorker, NULL)))
+			err(1, "couldn't start worker thread");
+	for (int i = 0; i < numThreads; ++i)
+		pthread_join(threads[i], NULL);
+	return throughput.saves / (now() - t);
+}
+
+static bool writeFile(const char *dir, const char *name, const uint8_t *data, size_t len)
+{
+	char path[4096];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	f = fopen(path, "wb");
+	if (!f || fwrite(data, 1, len, f) != len || fclose(f)) {
+		warn("couldn't write '%s'", path);
+		return false;
+	}
+	return true;
+}
+
+// Print the results, one per line: name, value, unit. Given a baseline in
+// the same format, add its value and the ratio of the two.
+static void printResults(const char *baselinePath)
+{
+	FILE *f = NULL;
+	char line[256], name[64], unit[32];
+	double value;
+
+	if (baselinePath) {
+		f = fopen(baselinePath, "r");
+		if (!f)
+			err(1, "couldn't open baseline '%s'", baselinePath);
+	}
+	printf("# %s %s, tile decoder %s\n", PROGNAME, __progversion, tileDecoderName());
+	printf("# name\tvalue\tunit%s\n", f ? "\tbaseline\tratio" : "");
+	for (int i = 0; i < numResults; ++i) {
+		bool found = false;
+
+		printf("%s\t%.4g\t%s", results[i].name, results[i].value, results[i].unit);
+		if (f) {
+			rewind(f);
+			while (fgets(line, sizeof(line), f))
+				if (line[0] != '#' && sscanf(line, "%63s %lf %31s", name, &value, unit) == 3
+				 && !strcmp(name, results[i].name) && value != 0) {
+					printf("\t%.4g\t%.3f", value, results[i].value / value);
+					found = true;
+					break;
+				}
+			if (!found)
+				printf("\t-\t-");
+		}
+		printf("\n");
+	}
+	if (f)
+		fclose(f);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: %s [-s seconds] [-j threads] [-b baseline.txt]\n"
+		"       %s -g dir\n",
+		PROGNAME, PROGNAME
+	);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	static const char *tileKernels[] = {"sse2", "bmi2", "neon", "scalar"};
+	static const char *encoders[] = {"libpng", "builtin"};
+	static const char *profiles[] = {"balanced", "fast", "smallest"};
+	static const char *formats[] = {"raw2", "raw8", "pgm", "qoi"};
+	static uint8_t storage[GBCAM_ROM_STORAGE_SIZE];
+	static struct DecodeCtx_s decode;
+	static struct EncodeCtx_s encode;
+	const char *baselinePath = NULL, *genDir = NULL;
+	const char *defaultKernel = tileDecoderName();
+	struct GbCam_Rom_s *frames, *hkFrames;
+	char name[32];
+	uint8_t tileBuf[GBCAM_IMAGE_SIZE];
+	int maxThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	int rc;
+
+	while ((rc = getopt(argc, argv, "s:j:b:g:")) != -1)
+		switch (rc) {
+		case 's':
+			minSeconds = atof(optarg);
+			if (minSeconds <= 0)
+				usage();
+			break;
+		case 'j':
+			maxThreads = atoi(optarg);
+			if (maxThreads < 1)
+				usage();
+			break;
+		case 'b':
+			baselinePath = optarg;
+			break;
+		case 'g':
+			genDir = optarg;
+			break;
+		default:
+			usage();
+		}
+	if (maxThreads < 1)
+		maxThreads = 1;
+
+	for (int i = 0; i < NUM_SAVES; ++i)
+		makeSave(saves[i], 0x9e3779b9u * (i + 1));
+	makeRom(rom, false);
+	makeRom(hkRom, true);
+
+	// -g writes the synthetic data out, for trying the tool itself.
+	if (genDir) {
+		bool ok = writeFile(genDir, "rom.gb", rom, sizeof(rom))
+			&& writeFile(genDir, "hk.gb", hkRom, sizeof(hkRom));
+		for (int i = 0; ok && i < NUM_SAVES; ++i) {
+			snprintf(name, sizeof(name), "save%d.sav", i + 1);
+			ok = writeFile(genDir, name, saves[i], GBCAM_SAVE_SIZE);
+		}
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	report("interleave", timeLoop(benchInterleave, NULL) * 1e9, "ns/call");
+	for (size_t i = 0; i < sizeof(tileKernels)/sizeof(tileKernels[0]); ++i) {
+		if (!selectTileDecoder(tileKernels[i]))
+			continue;
+		snprintf(name, sizeof(name), "tile_%s", tileKernels[i]);
+		report(name, timeLoop(benchTiles, tileBuf) * 1e9, "ns/tile");
+	}
+	selectTileDecoder(defaultKernel);
+
+	GbCam_OpenSave(&decode.save, saves[0], GBCAM_SAVE_SIZE);
+	decode.frames = NULL;
+	report("decode_norom", timeLoop(benchDecode, &decode) * 1e6, "us/image");
+	GbCam_OpenRom(&frames, rom, sizeof(rom), storage, sizeof(storage));
+	decode.frames = frames;
+	report("decode_rom", timeLoop(benchDecode, &decode) * 1e6, "us/image");
+	GbCam_CloseRom(frames);
+	GbCam_OpenRom(&hkFrames, hkRom, sizeof(hkRom), storage, sizeof(storage));
+	decode.frames = hkFrames;
+	report("decode_hk", timeLoop(benchDecode, &decode) * 1e6, "us/image");
+	GbCam_CloseRom(hkFrames);
+
+	report("frames_rom", timeLoop(benchFrames, &(struct FramesCtx_s){rom, storage}) * 1e6 / 18, "us/frame");
+	report("frames_hk", timeLoop(benchFrames, &(struct FramesCtx_s){hkRom, storage}) * 1e6 / 25, "us/frame");
+
+	GbCam_OpenRom(&frames, rom, sizeof(rom), storage, sizeof(storage));
+	for (int slot = 1; slot <= 30; ++slot)
+		GbCam_DecodeSlot(&decode.save, frames, slot, encode.images[slot-1], GBCAM_IMAGE_SIZE);
+	for (size_t i = 0; i < sizeof(encoders)/sizeof(encoders[0]); ++i)
+		for (size_t j = 0; j < sizeof(profiles)/sizeof(profiles[0]); ++j) {
+			ImageEncoder_Init(&encode.enc, IMAGE_FORMAT_PNG);
+			encode.enc.png.useLibpng = i == 0;
+			PngEncoder_ParseProfile(profiles[j], &encode.enc.png.profile);
+			snprintf(name, sizeof(name), "encode_%s_%s", encoders[i], profiles[j]);
+			report(name, timeLoop(benchEncode, &encode) * 1e6, "us/image");
+			encode.bytes = 0;
+			benchEncode(&encode, 30);
+			snprintf(name, sizeof(name), "size_%s_%s", encoders[i], profiles[j]);
+			report(name, encode.bytes / 30.0, "bytes/image");
+			ImageEncoder_Free(&encode.enc);
+		}
+	for (size_t i = 0; i < sizeof(formats)/sizeof(formats[0]); ++i) {
+		enum ImageFormat_e format;
+		ImageEncoder_ParseFormat(formats[i], &format);
+		ImageEncoder_Init(&encode.enc, format);
+		snprintf(name, sizeof(name), "encode_%s", formats[i]);
+		report(name, timeLoop(benchEncode, &encode) * 1e6, "us/image");
+		encode.bytes = 0;
+		benchEncode(&encode, 30);
+		snprintf(name, sizeof(name), "size_%s", formats[i]);
+		report(name, encode.bytes / 30.0, "bytes/image");
+		ImageEncoder_Free(&encode.enc);
+	}
+
+	for (int threads = 1; threads <= maxThreads; threads = threads < maxThreads && threads * 2 > maxThreads ? maxThreads : threads * 2) {
+		snprintf(name, sizeof(name), "saves_%dt", threads);
+		report(name, savesPerSecond(frames, threads, PNG_PROFILE_BALANCED), "saves/s");
+	}
+	// smallest tries its settings one after another, so this is what a
+	// single save with -p smallest -j1 costs.
+	report("saves_smallest_1t", savesPerSecond(frames, 1, PNG_PROFILE_SMALLEST), "saves/s");
+	GbCam_CloseRom(frames);
+
+	printResults(baselinePath);
+	return EXIT_SUCCESS;
+}
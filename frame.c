@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2013-2020 jkbenaim et al.
+ *
+ * This program is free software; you may redistribute and/or modify it under
+ * the terms of the expat license (also known as the "MIT license").
+ *
+ * This program is distributed in the hope that it will be useful, but without
+ * any warranty; without even the implied warranty of merchantability or
+ * firness for a particular purpose.
+ *
+ * For the full license text, see LICENSE.
+ *
+ ******************************************************************************
+ *
+ * This file implements the picture frames: finding them in the rom, and
+ * keeping a decoded template of each one so that a border is only drawn
+ * once per run.
+ *
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "frame.h"
+#include "hash.h"
+#include "tile.h"
+
+const int HELLO_KITTY_FRAME_OFFSETS[25][2] = {{0xC6C70, 0xCF5D0}, {0xC3B80, 0xCF548}, {0xCBEC0, 0xCF4C0}, {0xC5F10, 0xCF658}, {0xCF210, 0xCF7F0}, {0xC73A0, 0xCF768}, {0xB7420, 0xCF6E0}, {0xBE3E0, 0xCF438}, {0xB3CD0, 0xC7EF0}, {0xB2B80, 0xCF3B0}, {0x8FD50, 0xC7F78}, {0xC3800, 0xD7800}, {0xBDC00, 0xD3F70}, {0xD7F70, 0xD7888}, {0xC5C00, 0xD7998}, {0xB7C20, 0xD7910}, {0xC3ED0, 0xD3D50}, {0x33F80, 0xD3CC8}, {0xDB800, 0xD3DD8}, {0xB2200, 0xD3EE8}, {0xB34D0, 0xD3E60}, {0xB3030, 0xD7A20}, {0x93E00, 0xD7D50}, {0x77FE0, 0xCFCB8}, {0x77FF0, 0xCFDC4}};
+#define ROM_TITLE_OFFSET 0x134
+#define ROM_TITLE_LENGTH 0xF
+
+#define BANK_SIZE 0x4000
+#define BANK(bank) BANK_SIZE * bank
+
+#define ROW_SIZE 40
+#define HEIGHT 144
+
+static const uint8_t blankTemplate[FRAME_TEMPLATE_SIZE];
+
+bool isHkRom(const uint8_t rom[0x150])
+{
+	if (!memcmp(rom + ROM_TITLE_OFFSET, "POCKETCAMERA_SN", ROM_TITLE_LENGTH))
+		return true;
+	else
+		return false;
+}
+
+const uint8_t *getFrame(const uint8_t rom[], int frameNumber)
+{
+	int frameAddress;
+
+	if (!rom) {
+		return NULL;
+	}
+
+	if (isHkRom(rom))
+	{
+		// validate the frame number, hello kitty version has 25 frames
+		if( frameNumber < 0 || frameNumber >= 25 )
+			frameNumber = 24;
+
+		// retrieve the border address
+		frameAddress = HELLO_KITTY_FRAME_OFFSETS[frameNumber][0];
+	}
+	else
+	{
+		// validate the frame number
+		if (frameNumber < 0 || frameNumber >= 18)
+			frameNumber = 13;
+
+		// calculate the border address.
+		// it can be in one of two banks.
+		if(frameNumber < 9)
+			frameAddress = BANK(0x34) + frameNumber * 0x688;
+		else
+			frameAddress = BANK(0x35) + (frameNumber - 9) * 0x688;
+	}
+
+	return &rom[frameAddress];
+}
+
+// Out-of-range frame numbers fall back to the same default as getFrame().
+int clampFrameNumber(const struct FrameCache_s *c, int frameNumber)
+{
+	if (frameNumber < 0 || frameNumber >= c->numFrames)
+		return c->hk ? 24 : 13;
+	return frameNumber;
+}
+
+// Hash of everything the templates are drawn from: the rom header and the
+// frame data (both frame banks, or each Hello Kitty frame's tiles and map).
+uint64_t frameDataKey(const uint8_t *rom)
+{
+	uint64_t key = hash64(rom + 0x100, 0x50, 0);
+
+	if (isHkRom(rom)) {
+		for (int i = 0; i < 25; ++i) {
+			key = hash64(rom + HELLO_KITTY_FRAME_OFFSETS[i][0], 0x1000, key);
+			key = hash64(rom + HELLO_KITTY_FRAME_OFFSETS[i][1], 0x88, key);
+		}
+	} else {
+		key = hash64(rom + BANK(0x34), BANK_SIZE * 2, key);
+	}
+	return key;
+}
+
+static void drawTile(uint8_t *dst, const uint8_t *tile, int x, int y)
+{
+	decodeTile(dst + (x/4) + y * ROW_SIZE, ROW_SIZE, tile);
+}
+
+static void drawFrame(const struct FrameCache_s *c, int frameNumber, uint8_t *dst)
+{
+	const uint8_t *frame = getFrame(c->rom, frameNumber);
+	const uint8_t *tileMap;
+	int xTile, yTile, z;
+
+	if (c->hk)
+		tileMap = c->rom + HELLO_KITTY_FRAME_OFFSETS[frameNumber][1];
+	else
+		tileMap = frame + 0x600;
+
+	memset(dst, 0, FRAME_TEMPLATE_SIZE);
+
+	// Draw the sides of the frame
+	for (yTile = 0; yTile < 14; ++yTile)
+		for (z = 0; z < 4; ++z)
+			drawTile(dst, frame + tileMap[0x50 + yTile*4 + z]*16,
+				((z&1)?8:0) + ((z&2)?HEIGHT:0), 16 + yTile*8);
+
+	// Draw the top and bottom of the frame
+	for (xTile = 0; xTile < 20; ++xTile)
+		for (z = 0; z < 4; ++z)
+			drawTile(dst, frame + tileMap[xTile + 0x14*z]*16,
+				xTile*8, ((z&1)?8:0) + ((z&2)?128:0));
+}
+
+// Templates are drawn into storage, which must hold numFrames templates.
+// With no rom, every frame is the blank template and storage isn't used.
+void FrameCache_InitStorage(struct FrameCache_s *c, const uint8_t *rom, uint8_t *storage)
+{
+	memset(c, 0, sizeof(*c));
+	pthread_mutex_init(&c->_lock, NULL);
+	c->rom = rom;
+	if (!rom)
+		return;
+	c->hk = isHkRom(rom);
+	c->numFrames = c->hk ? 25 : 18;
+	c->_templates = (uint8_t (*)[FRAME_TEMPLATE_SIZE])storage;
+}
+
+// Use templates that were drawn earlier, e.g. from the on-disk cache. They
+// must stay valid until the cache is freed.
+void FrameCache_InitTemplates(struct FrameCache_s *c, const uint8_t *templates, int numFrames, bool hk)
+{
+	memset(c, 0, sizeof(*c));
+	pthread_mutex_init(&c->_lock, NULL);
+	c->hk = hk;
+	c->numFrames = numFrames;
+	c->_templates = (uint8_t (*)[FRAME_TEMPLATE_SIZE])templates;
+	memset(c->_ready, 1, numFrames);
+}
+
+// Returns the template for a frame, drawing it on first use. Safe to call
+// from several threads.
+const uint8_t *FrameCache_Get(struct FrameCache_s *c, int frameNumber)
+{
+	if (!c->numFrames)
+		return blankTemplate;
+
+	frameNumber = clampFrameNumber(c, frameNumber);
+	if (!__atomic_load_n(&c->_ready[frameNumber], __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&c->_lock);
+		if (!c->_ready[frameNumber]) {
+			drawFrame(c, frameNumber, c->_templates[frameNumber]);
+			__atomic_store_n(&c->_ready[frameNumber], 1, __ATOMIC_RELEASE);
+		}
+		pthread_mutex_unlock(&c->_lock);
+	}
+	return c->_templates[frameNumber];
+}
+
+void FrameCache_Free(struct FrameCache_s *c)
+{
+	c->_templates = NULL;
+	pthread_mutex_destroy(&c->_lock);
+}
@@ -0,0 +1,38 @@
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// A template is a whole 160x144 2bpp image with the border drawn and the
+// photo area left black.
+#define FRAME_TEMPLATE_SIZE (40*144)
+#define MAX_FRAMES 25
+
+struct FrameCache_s {
+	const uint8_t *rom;
+	bool hk;
+	int numFrames;
+	pthread_mutex_t _lock;
+	uint8_t _ready[MAX_FRAMES];
+	uint8_t (*_templates)[FRAME_TEMPLATE_SIZE];
+};
+
+bool isHkRom(const uint8_t rom[0x150]);
+const uint8_t *getFrame(const uint8_t rom[], int frameNumber);
+int clampFrameNumber(const struct FrameCache_s *c, int frameNumber);
+uint64_t frameDataKey(const uint8_t *rom);
+
+// What libgbcam hands out as an opaque struct GbCam_Rom_s.
+struct GbCam_Rom_s {
+	struct FrameCache_s frames;
+};
+
+void FrameCache_InitStorage(struct FrameCache_s *c, const uint8_t *rom, uint8_t *storage);
+void FrameCache_InitTemplates(struct FrameCache_s *c, const uint8_t *templates, int numFrames, bool hk);
+const uint8_t *FrameCache_Get(struct FrameCache_s *c, int frameNumber);
+void FrameCache_Free(struct FrameCache_s *c);
+
+/* _FRAME_H_ */
+#endif
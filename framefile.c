@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2013-2020 jkbenaim et al.
+ *
+ * This program is free software; you may redistribute and/or modify it under
+ * the terms of the expat license (also known as the "MIT license").
+ *
+ * This program is distributed in the hope that it will be useful, but without
+ * any warranty; without even the implied warranty of merchantability or
+ * firness for a particular purpose.
+ *
+ * For the full license text, see LICENSE.
+ *
+ ******************************************************************************
+ *
+ * This file implements the on-disk frame cache. Each rom's frame templates
+ * are stored in a file named after a hash of the rom header and frame data,
+ * laid out so that it can be mapped and used as is:
+ *
+ *   header (struct FrameFileHeader_s)
+ *   numFrames * FRAME_TEMPLATE_SIZE bytes of templates
+ *
+ * A second, tiny file named after the rom file's identity (path, size,
+ * mtime) holds that hash, so a later run can find the templates without
+ * opening the rom at all.
+ *
+ */
+
+#include "err_shim.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "frame.h"
+#include "framefile.h"
+#include "hash.h"
+#include "mapfile.h"
+
+#define FRAMEFILE_MAGIC "GBCF"
+#define FRAMEFILE_VERSION 1
+
+struct FrameFileHeader_s {
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	uint32_t numFrames;
+	uint32_t hk;
+	uint32_t crc;		// crc32 of the templates
+	uint32_t pad;
+};
+
+static bool cacheDir(char *dst, size_t len)
+{
+	const char *base;
+	char parent[PATH_MAX];
+
+#ifdef __MINGW32__
+	if (!(base = getenv("LOCALAPPDATA")))
+		return false;
+	snprintf(dst, len, "%s\\gbcamextract", base);
+	return (mkdir(dst) == 0 || errno == EEXIST);
+#else
+	if ((base = getenv("XDG_CACHE_HOME")) && *base) {
+		snprintf(parent, sizeof(parent), "%s", base);
+	} else if ((base = getenv("HOME")) && *base) {
+		snprintf(parent, sizeof(parent), "%s/.cache", base);
+	} else {
+		return false;
+	}
+	if (mkdir(parent, 0777) && errno != EEXIST)
+		return false;
+	snprintf(dst, len, "%s/gbcamextract", parent);
+	return (mkdir(dst, 0777) == 0 || errno == EEXIST);
+#endif
+}
+
+// The alias file name depends only on what stat() says about the rom, so
+// any change to the rom file gives a new name.
+static bool aliasPath(char *dst, size_t len, const char *dir, const char *romPath)
+{
+	struct stat sb;
+	uint64_t id[4];
+
+	if (stat(romPath, &sb) == -1)
+		return false;
+	id[0] = sb.st_dev;
+	id[1] = sb.st_ino;
+	id[2] = sb.st_size;
+	id[3] = sb.st_mtime;
+	snprintf(dst, len, "%s/rom-%016" PRIx64, dir,
+		hash64(romPath, strlen(romPath), hash64(id, sizeof(id), 0)));
+	return true;
+}
+
+static void templatePath(char *dst, size_t len, const char *dir, uint64_t key)
+{
+	snprintf(dst, len, "%s/%016" PRIx64 ".frames", dir, key);
+}
+
+// Map the cached templates for a rom, if there are any and they check out.
+// On success the cache borrows the mapping, which the caller closes after
+// freeing the cache.
+bool FrameFile_Load(const char *romPath, struct FrameCache_s *c, struct MappedFile_s *m)
+{
+	char dir[PATH_MAX], path[PATH_MAX];
+	const struct FrameFileHeader_s *h;
+	const uint8_t *templates;
+	uint64_t key;
+	FILE *f;
+	int n;
+
+	if (!cacheDir(dir, sizeof(dir)) || !aliasPath(path, sizeof(path), dir, romPath))
+		return false;
+	if (!(f = fopen(path, "r")))
+		return false;
+	n = fscanf(f, "%" SCNx64, &key);
+	fclose(f);
+	if (n != 1)
+		return false;
+
+	templatePath(path, sizeof(path), dir, key);
+	*m = MappedFile_Open(path, false);
+	if (!m->data)
+		return false;
+
+	h = m->data;
+	templates = (const uint8_t *)m->data + sizeof(*h);
+	if (m->size < sizeof(*h)
+	    || memcmp(h->magic, FRAMEFILE_MAGIC, 4)
+	    || h->version != FRAMEFILE_VERSION
+	    || h->key != key
+	    || h->numFrames != (h->hk ? 25 : 18)
+	    || m->size != sizeof(*h) + (uint64_t)h->numFrames * FRAME_TEMPLATE_SIZE
+	    || h->crc != crc32(0, templates, h->numFrames * FRAME_TEMPLATE_SIZE)) {
+		warnx("frame cache '%s' is stale or corrupt, rebuilding", path);
+		MappedFile_Close(*m);
+		m->data = NULL;
+		return false;
+	}
+
+	FrameCache_InitTemplates(c, templates, h->numFrames, h->hk);
+	return true;
+}
+
+// Draw every template of a rom-backed cache and write them out, together
+// with the alias for this rom file. Failing to write the cache is not an
+// error, it is only reported.
+bool FrameFile_Store(const char *romPath, struct FrameCache_s *c)
+{
+	char dir[PATH_MAX], path[PATH_MAX], tmp[PATH_MAX + 32];
+	struct FrameFileHeader_s h = {0};
+	struct MappedFile_s m;
+	uint8_t *templates;
+	size_t size;
+	FILE *f;
+
+	if (!c->rom || !cacheDir(dir, sizeof(dir)))
+		return false;
+
+	memcpy(h.magic, FRAMEFILE_MAGIC, 4);
+	h.version = FRAMEFILE_VERSION;
+	h.key = frameDataKey(c->rom);
+	h.numFrames = c->numFrames;
+	h.hk = c->hk;
+	size = sizeof(h) + (size_t)c->numFrames * FRAME_TEMPLATE_SIZE;
+
+	// Write to a temporary name and rename, so that a concurrent run never
+	// sees a half-written file.
+	templatePath(path, sizeof(path), dir, h.key);
+	snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+	m = MappedFile_Create(tmp, size);
+	if (!m.data) {
+		warn("couldn't create frame cache '%s'", tmp);
+		return false;
+	}
+	templates = (uint8_t *)m.data + sizeof(h);
+	for (int i = 0; i < c->numFrames; ++i)
+		memcpy(templates + i * FRAME_TEMPLATE_SIZE, FrameCache_Get(c, i), FRAME_TEMPLATE_SIZE);
+	h.crc = crc32(0, templates, c->numFrames * FRAME_TEMPLATE_SIZE);
+	memcpy(m.data, &h, sizeof(h));
+	MappedFile_Close(m);
+#ifdef __MINGW32__
+	remove(path);
+#endif
+	if (rename(tmp, path)) {
+		warn("couldn't create frame cache '%s'", path);
+		remove(tmp);
+		return false;
+	}
+
+	if (!aliasPath(path, sizeof(path), dir, romPath))
+		return false;
+	snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+	if (!(f = fopen(tmp, "w"))) {
+		warn("couldn't create frame cache '%s'", tmp);
+		return false;
+	}
+	fprintf(f, "%016" PRIx64 "\n", h.key);
+	if (fclose(f)) {
+		remove(tmp);
+		return false;
+	}
+#ifdef __MINGW32__
+	remove(path);
+#endif
+	if (rename(tmp, path)) {
+		remove(tmp);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,12 @@
+#ifndef _FRAMEFILE_H_
+#define _FRAMEFILE_H_
+
+#include <stdbool.h>
+#include "frame.h"
+#include "mapfile.h"
+
+bool FrameFile_Load(const char *romPath, struct FrameCache_s *c, struct MappedFile_s *m);
+bool FrameFile_Store(const char *romPath, struct FrameCache_s *c);
+
+/* _FRAMEFILE_H_ */
+#endif
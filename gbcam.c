@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2013-2020 jkbenaim et al.
+ *
+ * This program is free software; you may redistribute and/or modify it under
+ * the terms of the expat license (also known as the "MIT license").
+ *
+ * This program is distributed in the hope that it will be useful, but without
+ * any warranty; without even the implied warranty of merchantability or
+ * firness for a particular purpose.
+ *
+ * For the full license text, see LICENSE.
+ *
+ ******************************************************************************
+ *
+ * This file implements the save decoding, and the libgbcam API around it.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "frame.h"
+#include "gbcam.h"
+#include "pngcore.h"
+#include "sram.h"
+#include "tile.h"
+
+#define ROW_SIZE GBCAM_STRIDE
+#define HEIGHT GBCAM_HEIGHT
+
+bool isGbRom(const uint8_t data[0x150])
+{
+	const uint8_t sig[] = {0xce, 0xed, 0x66, 0x66};
+	if (!memcmp(data + 0x104, sig, 4))
+		return true;
+	else
+		return false;
+}
+
+int getPicNumForSlotNum(const uint8_t *save, int slotNum)
+{
+	int picNum;
+	struct firstslot_s *firstslot = (struct firstslot_s *)save;
+	if ((slotNum < 1) || (slotNum > 30))
+		return -1;
+	picNum = firstslot->vec[slotNum-1];
+	switch (picNum) {
+	case 0 ... 29:
+		picNum++;
+		break;
+	case 255:
+	default:
+		picNum = -1;
+		break;
+	}
+
+	return picNum;
+}
+
+static inline int picNum2BaseAddress(int picNum)
+{
+	// Picture 1 is at 0x2000, picture 2 is at 0x3000, etc.
+	return (picNum + 1) * 0x1000;
+}
+
+static void drawSpan(uint8_t pixelBuffer[], const uint8_t *buffer, int x, int y) {
+	decodeTile(pixelBuffer + (x/4) + y * ROW_SIZE, ROW_SIZE, buffer);
+}
+
+// The border comes ready-made from the frame cache; only the photo tiles
+// are decoded here.
+void convert(struct FrameCache_s *frames, const uint8_t saveBuffer[], uint8_t pixelBuffer[], int picNum)
+{
+	int baseAddress = picNum2BaseAddress(picNum);
+	int frameNumber = saveBuffer[baseAddress + 0xfb0];
+	int yTile, x, y;
+	const uint8_t *tile;
+
+	memcpy(pixelBuffer, FrameCache_Get(frames, frameNumber), ROW_SIZE*HEIGHT);
+
+	for (yTile = 0; yTile < 14; ++yTile)
+	{
+		y = 16 + yTile*8;
+		tile = saveBuffer + baseAddress + yTile*256;
+		for (x = 16; x <= 8*17; tile+=16, x+=8)
+		{
+			drawSpan(pixelBuffer, tile, x, y);
+		}
+	}
+}
+
+const char *GbCam_StrError(int rc)
+{
+	switch (rc) {
+	case GBCAM_OK:		return "success";
+	case GBCAM_EINVAL:	return "invalid argument";
+	case GBCAM_ESIZE:	return "wrong size";
+	case GBCAM_ENOTSAVE:	return "save expected, but rom was given";
+	case GBCAM_ENOTROM:	return "not a Game Boy rom";
+	case GBCAM_ENOSPC:	return "buffer too small";
+	default:		return "unknown error";
+	}
+}
+
+bool GbCam_IsRom(const void *data, size_t len)
+{
+	return data && len >= 0x150 && isGbRom(data);
+}
+
+// A save is told apart from other files of its size by the "Magic" that
+// ends either copy of its album order. len can be the whole save, or just
+// its first GBCAM_SAVE_HEADER_SIZE bytes.
+bool GbCam_IsSave(const void *data, size_t len)
+{
+	const struct firstslot_s *first = data;
+
+	return data && len >= GBCAM_SAVE_HEADER_SIZE && !isGbRom(data)
+		&& (!memcmp(first->magic, "Magic", 5) || !memcmp(first->magic2, "Magic", 5));
+}
+
+int GbCam_OpenSave(struct GbCam_Save_s *save, const void *buf, size_t len)
+{
+	if (!save || !buf)
+		return GBCAM_EINVAL;
+	if (len != GBCAM_SAVE_SIZE)
+		return GBCAM_ESIZE;
+	if (isGbRom(buf))
+		return GBCAM_ENOTSAVE;
+	save->data = buf;
+	return GBCAM_OK;
+}
+
+// The handle goes at the first 16-byte boundary in storage, and the frame
+// templates ROM_HEADER_SIZE bytes after it.
+#define ROM_HEADER_SIZE 240
+_Static_assert(sizeof(struct GbCam_Rom_s) <= ROM_HEADER_SIZE, "rom handle too big");
+_Static_assert(15 + ROM_HEADER_SIZE + MAX_FRAMES * FRAME_TEMPLATE_SIZE <= GBCAM_ROM_STORAGE_SIZE,
+	"GBCAM_ROM_STORAGE_SIZE too small");
+
+// Frames are drawn into storage as they are first needed, so storage must
+// stay valid until the rom is closed. With no rom, frames are blank and only
+// the handle is kept in storage.
+int GbCam_OpenRom(struct GbCam_Rom_s **handle, const void *rom, size_t len, void *storage, size_t storageLen)
+{
+	uint8_t *base = (uint8_t *)(((uintptr_t)storage + 15) & ~(uintptr_t)15);
+	size_t need = base - (uint8_t *)storage + ROM_HEADER_SIZE;
+	struct GbCam_Rom_s *r;
+
+	if (!handle || !storage)
+		return GBCAM_EINVAL;
+	if (rom) {
+		if (len != GBCAM_ROM_SIZE)
+			return GBCAM_ESIZE;
+		if (!isGbRom(rom))
+			return GBCAM_ENOTROM;
+		need += (size_t)(isHkRom(rom) ? 25 : 18) * FRAME_TEMPLATE_SIZE;
+	}
+	if (storageLen < need)
+		return GBCAM_ENOSPC;
+	r = (struct GbCam_Rom_s *)base;
+	FrameCache_InitStorage(&r->frames, rom, rom ? base + ROM_HEADER_SIZE : NULL);
+	*handle = r;
+	return GBCAM_OK;
+}
+
+void GbCam_CloseRom(struct GbCam_Rom_s *handle)
+{
+	if (handle)
+		FrameCache_Free(&handle->frames);
+}
+
+// Returns the picture number of a slot, or 0 if the slot is deleted.
+int GbCam_SlotPicture(const struct GbCam_Save_s *save, int slotNum)
+{
+	int picNum;
+
+	if (!save || slotNum < 1 || slotNum > GBCAM_NUM_SLOTS)
+		return GBCAM_EINVAL;
+	picNum = getPicNumForSlotNum(save->data, slotNum);
+	return picNum == -1 ? 0 : picNum;
+}
+
+int GbCam_ListSlots(const struct GbCam_Save_s *save, struct GbCam_SlotInfo_s slots[GBCAM_NUM_SLOTS])
+{
+	if (!save || !slots)
+		return GBCAM_EINVAL;
+	for (int slotNum = 1; slotNum <= GBCAM_NUM_SLOTS; ++slotNum) {
+		slots[slotNum-1].slot = slotNum;
+		slots[slotNum-1].picture = GbCam_SlotPicture(save, slotNum);
+		slots[slotNum-1].frame = save->data[picNum2BaseAddress(slotNum) + 0xfb0];
+	}
+	return GBCAM_NUM_SLOTS;
+}
+
+// Reads only the slot's metadata; nothing is decoded.
+int GbCam_SlotMetadata(const struct GbCam_Save_s *save, int slotNum, struct GbCam_Metadata_s *meta)
+{
+	const struct slot_s *slot;
+	const struct image_metadata_s *im;
+	const struct user_metadata_s *um;
+
+	if (!save || !meta || slotNum < 1 || slotNum > GBCAM_NUM_SLOTS)
+		return GBCAM_EINVAL;
+	slot = (const struct slot_s *)(save->data + picNum2BaseAddress(slotNum));
+	im = &slot->imagemeta;
+	um = &slot->usermeta;
+
+	memset(meta, 0, sizeof(*meta));
+	meta->slot = slotNum;
+	meta->picture = GbCam_SlotPicture(save, slotNum);
+	// The decoder takes the frame from the second copy.
+	meta->frame = slot->imagemeta2.border;
+	memcpy(meta->user.userId, &im->userid, 4);
+	memcpy(meta->user.username, im->username, 9);
+	meta->user.bloodSex = im->blood_sex;
+	memcpy(meta->user.birthdate, &im->birthdate, 4);
+	meta->user.magic = !memcmp(im->magic, "Magic", 5);
+	memcpy(meta->comment, im->comment, sizeof(meta->comment));
+	meta->copied = im->copied;
+	memcpy(meta->checksum, &im->checksum, 2);
+	memcpy(meta->owner.userId, &um->userid, 4);
+	memcpy(meta->owner.username, um->username, 9);
+	meta->owner.bloodSex = um->blood_sex;
+	memcpy(meta->owner.birthdate, &um->birhdate, 4);
+	meta->owner.magic = !memcmp(um->magic, "Magic", 5);
+	return GBCAM_OK;
+}
+
+// Decode a slot into out, which must hold GBCAM_IMAGE_SIZE bytes. frames
+// may be NULL for an unframed (black-bordered) image.
+int GbCam_DecodeSlot(const struct GbCam_Save_s *save, struct GbCam_Rom_s *rom, int slotNum, uint8_t *out, size_t outLen)
+{
+	static struct FrameCache_s noFrames;
+
+	if (!save || !out || slotNum < 1 || slotNum > GBCAM_NUM_SLOTS)
+		return GBCAM_EINVAL;
+	if (outLen < GBCAM_IMAGE_SIZE)
+		return GBCAM_ENOSPC;
+	convert(rom ? &rom->frames : &noFrames, save->data, out, slotNum);
+	return GBCAM_OK;
+}
+
+// Decode a slot's thumbnail into out, which must hold GBCAM_THUMB_SIZE
+// bytes. The thumbnail is 16 tiles after the photo, 4 by 4, row by row.
+int GbCam_DecodeThumbnail(const struct GbCam_Save_s *save, int slotNum, uint8_t *out, size_t outLen)
+{
+	const uint8_t *tile;
+
+	if (!save || !out || slotNum < 1 || slotNum > GBCAM_NUM_SLOTS)
+		return GBCAM_EINVAL;
+	if (outLen < GBCAM_THUMB_SIZE)
+		return GBCAM_ENOSPC;
+	tile = save->data + picNum2BaseAddress(slotNum) + 0xe00;
+	for (int t = 0; t < 16; ++t, tile += 16)
+		decodeTile(out + (t / 4) * 8 * GBCAM_THUMB_STRIDE + (t % 4) * 2, GBCAM_THUMB_STRIDE, tile);
+	return GBCAM_OK;
+}
+
+// Encode an image as PNG into out. work is scratch space for the encoder;
+// GBCAM_PNG_WORK_SIZE is enough for one full image. Returns the length of
+// the PNG.
+long GbCam_EncodePng(const uint8_t *pixels, int width, int height, int stride,
+	void *out, size_t outCap, void *work, size_t workLen)
+{
+	size_t len;
+
+	if (!pixels || !out || !work || width < 1 || height < 1 || stride < (width * 2 + 7) / 8)
+		return GBCAM_EINVAL;
+	len = encodeStaticPng(pixels, width, height, stride, out, outCap, work, workLen);
+	return len ? (long)len : GBCAM_ENOSPC;
+}
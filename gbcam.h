@@ -0,0 +1,154 @@
+#ifndef _GBCAM_H_
+#define _GBCAM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * libgbcam decodes Game Boy Camera saves. Nothing in it allocates memory or
+ * does I/O: saves, roms, images and work areas are all buffers supplied by
+ * the caller. Functions return a negative GBCAM_E* code on failure.
+ *
+ * Images are 160x144, 2 bits per pixel, 4 pixels per byte with the leftmost
+ * in the high bits, 0 = black. This is also PNG's 2-bit grayscale layout.
+ */
+
+#define GBCAM_SAVE_SIZE		131072
+#define GBCAM_ROM_SIZE		1048576
+#define GBCAM_NUM_SLOTS		30
+#define GBCAM_WIDTH		160
+#define GBCAM_HEIGHT		144
+#define GBCAM_STRIDE		40
+#define GBCAM_IMAGE_SIZE	(GBCAM_STRIDE * GBCAM_HEIGHT)
+
+// How much of the start of a save GbCam_IsSave needs: up to the end of the
+// second copy of the album order.
+#define GBCAM_SAVE_HEADER_SIZE	0x1200
+
+// The photo itself is 128x112, in the middle of the image, inside the
+// frame. It starts on a byte, so it can be used in place with the image's
+// stride.
+#define GBCAM_PHOTO_X		16
+#define GBCAM_PHOTO_Y		16
+#define GBCAM_PHOTO_WIDTH	128
+#define GBCAM_PHOTO_HEIGHT	112
+
+// Thumbnails are 32x32, in the same pixel format.
+#define GBCAM_THUMB_WIDTH	32
+#define GBCAM_THUMB_HEIGHT	32
+#define GBCAM_THUMB_STRIDE	8
+#define GBCAM_THUMB_SIZE	(GBCAM_THUMB_STRIDE * GBCAM_THUMB_HEIGHT)
+
+// Room for an opened rom: its handle and the drawn frames, 25 of them at
+// most, each a whole image.
+#define GBCAM_ROM_STORAGE_SIZE	(256 + 25 * GBCAM_IMAGE_SIZE)
+
+// Enough output and work space to encode one 160x144 image as PNG.
+#define GBCAM_PNG_MAX_SIZE	8192
+#define GBCAM_PNG_WORK_SIZE	(448 * 1024)
+
+// libgbcam.so is built with -fvisibility=hidden; this marks what it exports.
+#if defined(__GNUC__) && !defined(__MINGW32__)
+#define GBCAM_API __attribute__((visibility("default")))
+#else
+#define GBCAM_API
+#endif
+
+enum GbCam_Error_e {
+	GBCAM_OK = 0,
+	GBCAM_EINVAL = -1,	// bad argument, e.g. a slot number out of range
+	GBCAM_ESIZE = -2,	// a save or rom with the wrong size
+	GBCAM_ENOTSAVE = -3,	// a rom was given where a save was expected
+	GBCAM_ENOTROM = -4,	// not a Game Boy rom
+	GBCAM_ENOSPC = -5,	// an output or work buffer is too small
+};
+
+struct GbCam_Save_s {
+	const uint8_t *data;
+};
+
+// An opened rom. It lives in storage supplied by the caller.
+struct GbCam_Rom_s;
+
+struct GbCam_SlotInfo_s {
+	int slot;		// 1 to 30
+	int picture;		// 1 to 30, or 0 if the slot is deleted
+	int frame;		// frame number as stored in the save
+};
+
+// A slot's metadata, from the first copy of each block. Names and comments
+// are in the camera's own character set, and the byte order of the ids,
+// dates and checksum isn't known, so they are left as raw bytes.
+struct GbCam_User_s {
+	uint8_t userId[4];
+	uint8_t username[9];
+	uint8_t bloodSex;
+	uint8_t birthdate[4];
+	bool magic;		// the block ends in "Magic"
+};
+
+struct GbCam_Metadata_s {
+	int slot;
+	int picture;		// 0 if the slot is deleted
+	int frame;		// the frame the photo is drawn with
+	struct GbCam_User_s user;	// who took the photo
+	uint8_t comment[27];
+	bool copied;
+	uint8_t checksum[2];
+	struct GbCam_User_s owner;	// the camera's owner
+};
+
+// How far a block of metadata can be trusted, best first.
+enum GbCam_Trust_e {
+	GBCAM_TRUST_OK,		// checksum good, backup identical
+	GBCAM_TRUST_PRIMARY,	// checksum good, backup differs
+	GBCAM_TRUST_BACKUP,	// primary bad, backup good
+	GBCAM_TRUST_UNVERIFIED,	// checksums fail, but the copies agree
+	GBCAM_TRUST_BAD,	// neither copy checks out
+	GBCAM_NUM_TRUST,
+};
+
+struct GbCam_BlockCheck_s {
+	bool magic;
+	bool checksum;
+};
+
+struct GbCam_SlotReport_s {
+	enum GbCam_Trust_e trust;	// the worse of image and user
+	enum GbCam_Trust_e image;
+	enum GbCam_Trust_e user;
+	struct GbCam_BlockCheck_s imageChecks[2];	// primary, backup
+	struct GbCam_BlockCheck_s userChecks[2];
+	bool imageCopiesMatch;
+	bool userCopiesMatch;
+};
+
+struct GbCam_Report_s {
+	enum GbCam_Trust_e album;	// the slot order
+	struct GbCam_BlockCheck_s albumChecks[2];
+	bool albumCopiesMatch;
+	struct GbCam_SlotReport_s slots[GBCAM_NUM_SLOTS];
+	int counts[GBCAM_NUM_TRUST];	// slots at each level
+};
+
+GBCAM_API const char *GbCam_StrError(int rc);
+GBCAM_API bool GbCam_IsRom(const void *data, size_t len);
+GBCAM_API bool GbCam_IsSave(const void *data, size_t len);
+
+GBCAM_API int GbCam_OpenSave(struct GbCam_Save_s *save, const void *buf, size_t len);
+GBCAM_API int GbCam_OpenRom(struct GbCam_Rom_s **handle, const void *rom, size_t len, void *storage, size_t storageLen);
+GBCAM_API void GbCam_CloseRom(struct GbCam_Rom_s *handle);
+
+GBCAM_API int GbCam_SlotPicture(const struct GbCam_Save_s *save, int slotNum);
+GBCAM_API int GbCam_ListSlots(const struct GbCam_Save_s *save, struct GbCam_SlotInfo_s slots[GBCAM_NUM_SLOTS]);
+GBCAM_API int GbCam_SlotMetadata(const struct GbCam_Save_s *save, int slotNum, struct GbCam_Metadata_s *meta);
+GBCAM_API int GbCam_DecodeSlot(const struct GbCam_Save_s *save, struct GbCam_Rom_s *rom, int slotNum, uint8_t *out, size_t outLen);
+GBCAM_API int GbCam_DecodeThumbnail(const struct GbCam_Save_s *save, int slotNum, uint8_t *out, size_t outLen);
+GBCAM_API int GbCam_VerifySave(const struct GbCam_Save_s *save, struct GbCam_Report_s *report);
+GBCAM_API const char *GbCam_TrustName(enum GbCam_Trust_e trust);
+GBCAM_API long GbCam_EncodePng(const uint8_t *pixels, int width, int height, int stride,
+	void *out, size_t outCap, void *work, size_t workLen);
+
+/* _GBCAM_H_ */
+#endif
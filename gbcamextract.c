@@ -18,84 +18,176 @@
 
 #include "err_shim.h"
 #include <errno.h>      // errno
-#include <png.h>
+#include <limits.h>     // PATH_MAX
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>      // printf, fopen, fclose, fread
 #include <stdlib.h>     // malloc, EXIT_SUCCESS, EXIT_FAILURE, NULL
 #include <string.h>     // strerror
-#include <zlib.h>
+#include <sys/stat.h>   // mkdir
+#ifndef __MINGW32__
+#include <getopt.h>     // getopt_long
+#endif
+#include "frame.h"
+#include "framefile.h"
+#include "gbcam.h"
+#include "hash.h"
 #include "mapfile.h"
+#include "memo.h"
+#include "metaindex.h"
+#include "output.h"
+#include "imgenc.h"
+#include "pngenc.h"
+#include "scan.h"
+#include "server.h"
 #include "sram.h"
+#include "statefile.h"
+#include "stats.h"
+#include "store.h"
+#include "watch.h"
 #include "wingetopt.h"
 
-const int HELLO_KITTY_FRAME_OFFSETS[25][2] = {{0xC6C70, 0xCF5D0}, {0xC3B80, 0xCF548}, {0xCBEC0, 0xCF4C0}, {0xC5F10, 0xCF658}, {0xCF210, 0xCF7F0}, {0xC73A0, 0xCF768}, {0xB7420, 0xCF6E0}, {0xBE3E0, 0xCF438}, {0xB3CD0, 0xC7EF0}, {0xB2B80, 0xCF3B0}, {0x8FD50, 0xC7F78}, {0xC3800, 0xD7800}, {0xBDC00, 0xD3F70}, {0xD7F70, 0xD7888}, {0xC5C00, 0xD7998}, {0xB7C20, 0xD7910}, {0xC3ED0, 0xD3D50}, {0x33F80, 0xD3CC8}, {0xDB800, 0xD3DD8}, {0xB2200, 0xD3EE8}, {0xB34D0, 0xD3E60}, {0xB3030, 0xD7A20}, {0x93E00, 0xD7D50}, {0x77FE0, 0xCFCB8}, {0x77FF0, 0xCFDC4}};
-#define ROM_TITLE_OFFSET 0x134
-#define ROM_TITLE_LENGTH 0xF
-
-#define BANK_SIZE 0x4000
-#define BANK(bank) BANK_SIZE * bank
-
 const int FILE_ERROR = 2;
 const int FILE_SIZE_ERROR = 3;
 
-const int WIDTH = 160;
-const int ROW_SIZE = 40; // WIDTH/4: 2 bits per pixel means 4 pixels per byte
-const int HEIGHT = 144;
-const int SAVEGAME_SIZE = 128*1024;
-const int ROM_BUFFER_SIZE = 1024*1024;
-
-static inline int picNum2BaseAddress(int picNum);
-uint8_t *getFrame(uint8_t rom[], int frameNumber);
-static inline unsigned int interleaveBytes(uint8_t low, uint8_t high);
-void convert(uint8_t framesBuffer[], uint8_t saveBuffer[], uint8_t pixelBuffer[], int picNum);
-void writeImageFile(uint8_t pixelBuffer[], const char *filename);
-void drawSpan(uint8_t pixelBuffer[], uint8_t *buffer, int x, int y);
-void readData(uint8_t *fileName, uint8_t *buffer, int offset);
-bool isGbRom(const uint8_t data[0x150]);
-bool isHkRom(const uint8_t rom[0x150]);
-static void usage(void);
-static void version(void);
+const int WIDTH = GBCAM_WIDTH;
+const int ROW_SIZE = GBCAM_STRIDE; // WIDTH/4: 2 bits per pixel means 4 pixels per byte
+const int HEIGHT = GBCAM_HEIGHT;
 
-bool isGbRom(const uint8_t data[0x150])
-{
-	const uint8_t sig[] = {0xce, 0xed, 0x66, 0x66};
-	if (!memcmp(data + 0x104, sig, 4))
-		return true;
-	else
-		return false;
-}
+#define MAX_PALETTES 16
 
-int getPicNumForSlotNum(const uint8_t *save, int slotNum)
-{
-	int picNum;
-	struct firstslot_s *firstslot = (struct firstslot_s *)save;
-	if ((slotNum < 1) || (slotNum > 30))
-		return -1;
-	picNum = firstslot->vec[slotNum-1];
-	switch (picNum) {
-	case 0 ... 29:
-		picNum++;
-		break;
-	case 255:
-	default:
-		picNum = -1;
-		break;
-	}
+// A save that is being extracted. Its 30 slots are handed out one at a time
+// to the workers; the save is unmapped once the last of them is written.
+struct SaveJob_s {
+	struct MappedFile_s m;
+	char *path;
+	struct GbCam_Save_s save;
+	char dir[PATH_MAX];
+	bool nested;		// found by -R, so dir may need its parents made
+	uint32_t todo;		// bit n is set if slot n is to be extracted
+	int nextSlot;
+	int refs;
+	bool failed;
+	struct GbCam_Report_s report;
+	struct StateEntry_s state[30];
+	char oldNames[30][STATEFILE_NAME_SIZE];
+	bool stateChanged;
+	struct StoreRef_s objects[30];
+	struct SaveJob_s *next;
+	bool keep;		// watch mode runs the next pass on it
+};
 
-	return picNum;
-}
+// State shared by all workers. Everything but the settings (rom,
+// outdir, format, useMemo, builtinPng, profile, palettes, unframed,
+// sheetColumns, thumbnails, metaFormat, check, verify, incremental,
+// useStore and the keys) and out, memo and store, which do their own
+// locking, is protected by lock. So is scan. Saves that are open and
+// still have slots to hand out are queued from cur to last; opening counts
+// the workers that are opening one with lock released. numOpen counts the
+// saves that are mapped, from when they are claimed until they are closed,
+// and no more are claimed while it is at maxOpen, one more than there are
+// workers, however fast the paths come in.
+static struct {
+	pthread_mutex_t lock;
+	struct GbCam_Rom_s rom;
+	const char *outdir;
+	struct Output_s out;
+	struct EncodeMemo_s memo;
+	bool useMemo;
+	enum ImageFormat_e format;
+	bool builtinPng;
+	enum PngProfile_e profile;
+	struct PngPalette_s palettes[MAX_PALETTES];
+	int numPalettes;
+	bool unframed;
+	int sheetColumns;
+	bool thumbnails;
+	enum MetaIndexFormat_e metaFormat;
+	bool check;
+	bool verify;
+	bool incremental;
+	struct Store_s store;
+	bool useStore;
+	uint64_t settingsKey;
+	uint64_t frameKeys[MAX_FRAMES];
+	bool batch;
+	char *single;
+	char **argv;
+	FILE *list;
+	struct Scan_s scan;
+	bool scanning;
+	uint64_t *dirKeys;
+	size_t numDirKeys;
+	size_t dirKeysCap;
+	int delim;
+	struct SaveJob_s *cur;
+	struct SaveJob_s *last;
+	int opening;
+	int numOpen;
+	int maxOpen;
+	pthread_cond_t opened;
+	int failures;
+	int stateFailures;
+	struct Stats_s stats;
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.opened = PTHREAD_COND_INITIALIZER,
+	.delim = '\n',
+};
+
+void readData(uint8_t *fileName, uint8_t *buffer, int offset);
+static struct SaveJob_s *newSaveJob(char *filename_save, size_t rel);
+static bool openSaveJob(struct SaveJob_s *job, struct Stats_s *stats);
+static int nextTodo(const struct SaveJob_s *job, int slotNum);
+static void closeSaveJob(struct SaveJob_s *job);
+static char *nextSavePath(size_t *rel);
+static void *worker(void *arg);
+static char *readPath(FILE *f, int delim);
+static bool makeDir(const char *path);
+static bool makeDirs(char *path);
+static void saveOutputDir(char *dst, size_t len, const char *outdir, const char *filename_save, size_t rel);
+static void jobPath(char *dst, size_t len, const struct SaveJob_s *job, const char *fmt, int n);
+static void initKeys(void);
+static void runWorkers(int numThreads);
+static bool watchSave(const char *filename_save, int numThreads, int debounceMs);
+static void usage(void);
+static void version(void);
 
 int main(int argc, char *argv[])
 {
 	char *filename_save = NULL;
 	char *filename_rom = NULL;
+	char *filename_list = NULL;
+	char *outdir = ".";
+	char *serverPath = NULL;
+	char *clientPath = NULL;
+	char *storeDir = NULL;
+	bool storeVerify = false;
 	int rc;
-	struct MappedFile_s mSave = {0};
+	bool showStats = false;
+	int watchMs = -1;
+	enum StatsFormat_e statsFormat = STATS_TEXT;
+	struct StatsClock_s start;
+	int numThreads = 1;
+	int outFd = 1;
+	enum OutputKind_e outKind = OUTPUT_FILES;
+	bool useCache = false;
 	struct MappedFile_s mRom = {0};
-	uint8_t pixelBuffer[ROW_SIZE*HEIGHT];
+	struct MappedFile_s mCache = {0};
+	uint8_t *frameStorage = NULL;
 
-	while ((rc = getopt(argc, argv, "s:r:V")) != -1)
+	enum {OPT_STATS = 256, OPT_WATCH, OPT_CHECK, OPT_VERIFY, OPT_STORE_VERIFY};
+	static const struct option longOptions[] = {
+		{"check", no_argument, NULL, OPT_CHECK},
+		{"verify", no_argument, NULL, OPT_VERIFY},
+		{"stats", optional_argument, NULL, OPT_STATS},
+		{"store-verify", no_argument, NULL, OPT_STORE_VERIFY},
+		{"watch", optional_argument, NULL, OPT_WATCH},
+		{NULL, 0, NULL, 0},
+	};
+
+	while ((rc = getopt_long(argc, argv, "s:r:co:l:0j:e:f:p:P:a:t:O:d:C:S:RiuTm:V", longOptions, NULL)) != -1)
 		switch (rc) {
 		case 's':
 			if (filename_save) {
@@ -111,6 +203,130 @@ int main(int argc, char *argv[])
 			}
 			filename_rom = optarg;
 			break;
+		case 'c':
+			useCache = true;
+			break;
+		case 'o':
+			outdir = optarg;
+			break;
+		case 'l':
+			if (filename_list) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			filename_list = optarg;
+			break;
+		case '0':
+			pool.delim = '\0';
+			break;
+		case 'j':
+			numThreads = atoi(optarg);
+			if (numThreads < 1) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'e':
+			if (!strcmp(optarg, "builtin")) {
+				pool.builtinPng = true;
+			} else if (!strcmp(optarg, "libpng")) {
+				pool.builtinPng = false;
+			} else {
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'f':
+			if (!ImageEncoder_ParseFormat(optarg, &pool.format)) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'P':
+			if (pool.numPalettes == MAX_PALETTES)
+				errx(1, "too many palettes, at most %d", MAX_PALETTES);
+			if (!PngEncoder_ParsePalette(optarg, &pool.palettes[pool.numPalettes++])) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'p':
+			if (!PngEncoder_ParseProfile(optarg, &pool.profile)) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'a':
+			pool.sheetColumns = atoi(optarg);
+			if (pool.sheetColumns < 1 || pool.sheetColumns > 30) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case 't':
+			if (!Output_ParseKind(optarg, &outKind)) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'O':
+			outFd = atoi(optarg);
+			if (outFd < 0) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'd':
+			serverPath = optarg;
+			break;
+		case 'C':
+			clientPath = optarg;
+			break;
+		case 'S':
+			storeDir = optarg;
+			pool.useStore = true;
+			break;
+		case 'R':
+			pool.scanning = true;
+			break;
+		case 'i':
+			pool.incremental = true;
+			break;
+		case 'u':
+			pool.unframed = true;
+			break;
+		case 'T':
+			pool.thumbnails = true;
+			break;
+		case 'm':
+			if (!MetaIndex_ParseFormat(optarg, &pool.metaFormat)) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_STATS:
+			showStats = true;
+			if (optarg && !Stats_ParseFormat(optarg, &statsFormat)) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_CHECK:
+			pool.check = true;
+			break;
+		case OPT_VERIFY:
+			pool.verify = true;
+			break;
+		case OPT_STORE_VERIFY:
+			storeVerify = true;
+			break;
+		case OPT_WATCH:
+			watchMs = optarg ? atoi(optarg) : 5;
+			if (watchMs < 0) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
 		case 'V':
 			version();
 			return EXIT_FAILURE;
@@ -122,273 +338,1276 @@ int main(int argc, char *argv[])
 		}
 	argc -= optind;
 	argv += optind;
-	if (*argv != NULL) {
+
+	statsEnabled = showStats;
+	Stats_Begin(&start);
+
+#ifdef __MINGW32__
+	if (serverPath || clientPath)
+		errx(1, "daemon mode isn't supported on Windows");
+#else
+	// Client: hand the save to a running server, or ask for its stats.
+	if (clientPath) {
+		if (serverPath || *argv != NULL || filename_list || filename_rom) {
+			usage();
+			return EXIT_FAILURE;
+		}
+		return Server_Request(clientPath, filename_save, outKind, outFd) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	if (serverPath && (filename_save || *argv != NULL || filename_list || pool.sheetColumns || pool.thumbnails)) {
 		usage();
 		return EXIT_FAILURE;
 	}
+#endif
 
-	if (!filename_save) {
+	// A single -s keeps the old behaviour; anything else is a batch.
+	if (filename_save && (*argv != NULL || filename_list)) {
 		usage();
 		return EXIT_FAILURE;
 	}
 
-	// Open the save file.
-	mSave = MappedFile_Open(filename_save, false);
-	if (!mSave.data)
-		err(1, "couldn't open save for reading");
-
-	// Check the savegame's size.
-	if (mSave.size != 131072)
-		errx(1, "savegame has weird size");
-	
-	// Check if the save that we read is actually a rom.
-	if (isGbRom(mSave.data))
-		errx(1, "save expected, but rom was given");
-
-	// If a rom was given, open it.
-	if (filename_rom) {
+	if (!filename_save && *argv == NULL && !filename_list && !serverPath) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	if (useCache && !filename_rom) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	// -R walks the directories given for saves; it's a batch.
+	if (pool.scanning && (filename_save || *argv == NULL || serverPath)) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	// Watch mode is incremental, on a single save.
+	if (watchMs >= 0) {
+#ifndef __linux__
+		errx(1, "--watch is only supported on Linux");
+#endif
+		if (!filename_save) {
+			usage();
+			return EXIT_FAILURE;
+		}
+		pool.incremental = true;
+	}
+
+	// The metadata index and the integrity report are single streams;
+	// there are no images.
+	if ((pool.metaFormat || pool.check) && (outKind != OUTPUT_FILES || pool.sheetColumns || pool.thumbnails
+	 || pool.incremental || serverPath || (pool.metaFormat && pool.check))) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	// The unframed copy is cut from the framed image, one more file per
+	// slot.
+	if (pool.unframed && (pool.thumbnails || pool.sheetColumns || pool.incremental || serverPath
+	 || pool.metaFormat || pool.check)) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	// Palettes recolor PNGs, and make several files per image.
+	if (pool.numPalettes && (pool.format != IMAGE_FORMAT_PNG || pool.incremental || serverPath
+	 || pool.metaFormat || pool.check)) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	// The store holds one image per slot; each save only gets its
+	// manifest.
+	if ((pool.useStore && (outKind != OUTPUT_FILES || pool.sheetColumns || pool.incremental || serverPath
+	 || pool.metaFormat || pool.check || pool.unframed || pool.numPalettes)) || (storeVerify && !pool.useStore)) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	// Incremental mode compares against files on disk, one per slot.
+	if (pool.incremental && (outKind != OUTPUT_FILES || pool.sheetColumns || serverPath)) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	// If a rom was given, open it. This is done once for the whole batch,
+	// and not at all if its frames are in the cache.
+	if (useCache && FrameFile_Load(filename_rom, &pool.rom.frames, &mCache)) {
+		// frames come from the cache
+	} else if (filename_rom) {
 		mRom = MappedFile_Open(filename_rom, false);
 		if (!mRom.data)
 			err(1, "couldn't open rom for reading");
-		if (mRom.size != 1048576)
+		if (mRom.size != GBCAM_ROM_SIZE)
 			errx(1, "rom has weird size");
-		if (!isGbRom(mRom.data))
+		if (!GbCam_IsRom(mRom.data, mRom.size))
 			errx(1, "rom given doesn't look like a real rom");
+		frameStorage = malloc(MAX_FRAMES * FRAME_TEMPLATE_SIZE);
+		if (!frameStorage) err(1, "malloc failure");
+		FrameCache_InitStorage(&pool.rom.frames, mRom.data, frameStorage);
+		if (useCache)
+			FrameFile_Store(filename_rom, &pool.rom.frames);
+	} else {
+		FrameCache_InitStorage(&pool.rom.frames, NULL, NULL);
 	}
 
-	
-	// convert
-	memset(pixelBuffer, 0, ROW_SIZE*HEIGHT);    // set pixelBuffer to all black
+#ifndef __MINGW32__
+	if (serverPath) {
+		struct ServerConfig_s cfg = {
+			.path = serverPath,
+			.rom = &pool.rom,
+			.threads = numThreads,
+			.format = pool.format,
+			.builtinPng = pool.builtinPng,
+			.profile = pool.profile,
+		};
+		rc = Server_Run(&cfg) ? EXIT_SUCCESS : EXIT_FAILURE;
+		FrameCache_Free(&pool.rom.frames);
+		free(frameStorage);
+		if (mCache.data)
+			MappedFile_Close(mCache);
+		if (mRom.data)
+			MappedFile_Close(mRom);
+		return rc;
+	}
+#endif
 
-	for (int slotNum = 1; slotNum <= 30; ++slotNum)
-	{
-		int picNum = getPicNumForSlotNum(mSave.data, slotNum);
-		char filename[16] = {0};
-		convert(mRom.data, mSave.data, pixelBuffer, slotNum);
-		if (picNum != -1)
-			snprintf(filename, 15, "IMG_%02d.png", picNum);
-		else
-			snprintf(filename, 15, "DEL_%02d.png", slotNum);
-		filename[15] = '\0';
-		writeImageFile(pixelBuffer, filename);
+	if (filename_list) {
+		pool.list = stdin;
+		if (strcmp(filename_list, "-")) {
+			pool.list = fopen(filename_list, "rb");
+			if (!pool.list)
+				err(1, "couldn't open list '%s'", filename_list);
+		}
 	}
 
+	// Batch mode: every save gets a directory of its own under outdir.
+	// Archives hold the same layout, relative to the archive root.
+	pool.batch = !filename_save;
+	if (outKind == OUTPUT_FILES && !pool.metaFormat && !pool.check && (pool.batch || strcmp(outdir, ".")) && !makeDir(outdir))
+		err(1, "couldn't create output directory '%s'", outdir);
+	Output_Open(&pool.out, outKind, outFd);
+	if (pool.metaFormat == METAINDEX_BINARY) {
+		struct MetaIndex_s header;
+		MetaIndex_Init(&header, pool.metaFormat);
+		MetaIndex_AddHeader(&header);
+		if (!Output_WriteStream(&pool.out, header.buf, header.len))
+			pool.failures++;
+		MetaIndex_Free(&header);
+	}
+
+	if (pool.useStore && !Store_Open(&pool.store, storeDir, storeVerify))
+		return EXIT_FAILURE;
+	if (pool.incremental || pool.useStore)
+		initKeys();
+
+	// Encoding is worth remembering when it compresses; the raw formats
+	// are quicker to write again than to look up.
+	pool.useMemo = !pool.metaFormat && !pool.check
+		&& (pool.format == IMAGE_FORMAT_PNG || pool.format == IMAGE_FORMAT_QOI);
+	if (pool.useMemo)
+		EncodeMemo_Init(&pool.memo, MEMO_DEFAULT_MAX_BYTES);
+
+	// With -R, directories among the saves are scanned, and the saves
+	// given directly are extracted first.
+	if (pool.scanning) {
+		char **keep = argv;
+		struct stat st;
+		Scan_Init(&pool.scan);
+		for (char **p = argv; *p; ++p)
+			if (!stat(*p, &st) && S_ISDIR(st.st_mode))
+				Scan_AddRoot(&pool.scan, *p);
+			else
+				*keep++ = *p;
+		*keep = NULL;
+	}
+
+	pool.outdir = outdir;
+	pool.single = filename_save;
+	pool.argv = argv;
+
+	if (watchMs >= 0) {
+		if (!watchSave(filename_save, numThreads, watchMs))
+			pool.failures++;
+	} else {
+		runWorkers(numThreads);
+	}
+
+	if (pool.list && pool.list != stdin)
+		fclose(pool.list);
+	if (pool.scanning) {
+		pool.stats.skippedFiles = pool.scan.skipped;
+		pool.failures += pool.scan.failures;
+		Scan_Free(&pool.scan);
+	}
+	free(pool.dirKeys);
+
+	if (!Output_Close(&pool.out))
+		pool.failures++;
+
+	// Stats go to stderr, so as not to mix with an archive on stdout.
+	if (showStats)
+		Stats_Print(stderr, &pool.stats, statsFormat, &start);
+
+	if (pool.useMemo)
+		EncodeMemo_Free(&pool.memo);
+	FrameCache_Free(&pool.rom.frames);
+	free(frameStorage);
+	if (mCache.data)
+		MappedFile_Close(mCache);
+	if (mRom.data)
+		MappedFile_Close(mRom);
+
 	// Return
-	return EXIT_SUCCESS;
+	return pool.failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// What a worker owns: its pixel buffer, its image encoder state, in contact
+// sheet mode the sheet being composed, with -P the recolored copy being
+// written, and its share of the stats.
+struct Worker_s {
+	uint8_t pixelBuffer[FRAME_TEMPLATE_SIZE];	// same size as a whole image
+	struct ImageEncoder_s enc;
+	uint8_t *sheet;
+	uint8_t *recolored;
+	size_t recoloredCap;
+	struct MetaIndex_s index;
+	struct Stats_s stats;
+};
+
+// Everything a slot's image depends on: the photo, the border it is drawn
+// with, and the settings.
+static uint64_t imageKey(const struct SaveJob_s *job, int slotNum)
+{
+	const struct slot_s *slot = (const struct slot_s *)(job->save.data + (slotNum + 1) * 0x1000);
+	// The decoder takes the frame number from the second copy of the metadata.
+	int frameNumber = slot->imagemeta2.border;
+	uint64_t key = pool.settingsKey;
+
+	if (pool.thumbnails)
+		key = hash64(slot->thumbnail, sizeof(slot->thumbnail), key);
+	else if (pool.rom.frames.numFrames)
+		key ^= pool.frameKeys[clampFrameNumber(&pool.rom.frames, frameNumber)];
+	if (!pool.thumbnails)
+		key = hash64(slot->image, sizeof(slot->image), key);
+	return key;
+}
+
+// Everything a slot's output depends on: its image, and the file's name.
+static uint64_t slotKey(const struct SaveJob_s *job, int slotNum, const char *filename)
+{
+	const char *base = strrchr(filename, '/');
+	uint64_t key;
+
+	base = base ? base + 1 : filename;
+	key = hash64(base, strlen(base), imageKey(job, slotNum));
+	return key ? key : 1;
+}
+
+// Decode a slot's photo, or its thumbnail, into the worker's pixel buffer.
+// Sets the image's size.
+static void decodeImage(struct Worker_s *w, struct SaveJob_s *job, int slotNum, int *width, int *height, int *stride)
+{
+	if (pool.thumbnails) {
+		GbCam_DecodeThumbnail(&job->save, slotNum, w->pixelBuffer, sizeof(w->pixelBuffer));
+		*width = GBCAM_THUMB_WIDTH;
+		*height = GBCAM_THUMB_HEIGHT;
+		*stride = GBCAM_THUMB_STRIDE;
+	} else {
+		GbCam_DecodeSlot(&job->save, &pool.rom, slotNum, w->pixelBuffer, sizeof(w->pixelBuffer));
+		*width = WIDTH;
+		*height = HEIGHT;
+		*stride = ROW_SIZE;
+	}
+}
+
+// Only the size of the file is checked, so as not to read it back.
+static bool outputIntact(const char *filename, const struct StateEntry_s *state)
+{
+	struct stat st;
+	const char *base = strrchr(filename, '/');
+
+	return !strcmp(state->name, base ? base + 1 : filename)
+		&& !stat(filename, &st) && (uint64_t)st.st_size == state->size;
+}
+
+// Write an encoded image. With -P, the image is written once per palette
+// instead, with the palette's name added to the file name
+// (IMG_01_dmg.png). Each copy only differs in its PLTE chunk, so it is
+// spliced together from the one that was deflated.
+static bool writeImage(struct Worker_s *w, const char *filename, const uint8_t *data, size_t dataLen, size_t *bytes)
+{
+	const char *dot = strrchr(filename, '.');
+	char name[PATH_MAX + 32];
+	size_t need = dataLen + PNG_PALETTE_CHUNK_SIZE, len;
+
+	*bytes = 0;
+	if (!pool.numPalettes) {
+		*bytes = dataLen;
+		return Output_Write(&pool.out, filename, data, dataLen);
+	}
+	if (need > w->recoloredCap) {
+		free(w->recolored);
+		w->recolored = malloc(need);
+		if (!w->recolored) err(1, "malloc failure");
+		w->recoloredCap = need;
+	}
+	for (int i = 0; i < pool.numPalettes; ++i) {
+		len = PngEncoder_Recolor(data, dataLen, &pool.palettes[i], w->recolored, w->recoloredCap);
+		snprintf(name, sizeof(name), "%.*s_%s%s", (int)(dot - filename), filename, pool.palettes[i].name, dot);
+		if (!len) {
+			warnx("couldn't recolor '%s'", name);
+			return false;
+		}
+		if (!Output_Write(&pool.out, name, w->recolored, len))
+			return false;
+		*bytes += len;
+	}
+	return true;
+}
+
+// Encode an image of a slot, and remember it in the memo under the slot
+// bytes it was decoded from and how it was drawn (tag). Sets *data to the
+// encoded bytes, which stay valid until the worker encodes again.
+static bool encodeImage(struct Worker_s *w, const uint8_t *input, size_t inputLen, int tag,
+	const uint8_t *pixels, int width, int height, int stride, const uint8_t **data, size_t *len)
+{
+	if (!ImageEncoder_Encode(&w->enc, pixels, width, height, stride))
+		return false;
+	*data = w->enc.out;
+	*len = w->enc.outLen;
+	if (pool.useMemo)
+		EncodeMemo_Put(&pool.memo, input, inputLen, tag, w->enc.out, w->enc.outLen);
+	return true;
 }
 
-bool isHkRom(const uint8_t rom[0x150])
+static bool extractSlot(struct Worker_s *w, struct SaveJob_s *job, int slotNum)
 {
-	if (!memcmp(rom + ROM_TITLE_OFFSET, "POCKETCAMERA_SN", ROM_TITLE_LENGTH))
+	const struct slot_s *slot = (const struct slot_s *)(job->save.data + (slotNum + 1) * 0x1000);
+	int picNum = GbCam_SlotPicture(&job->save, slotNum);
+	char filename[PATH_MAX], fmt[32];
+	struct StatsClock_s c = {0}, slotStart;
+	struct StateEntry_s *state = &job->state[slotNum-1];
+	uint64_t key = 0;
+	int width, height, stride;
+	// What the image is made from, for the memo. Thumbnails have no frame,
+	// and the unframed photo is tagged -1.
+	const uint8_t *input = pool.thumbnails ? slot->thumbnail : slot->image;
+	size_t inputLen = pool.thumbnails ? sizeof(slot->thumbnail) : sizeof(slot->image);
+	int tag = pool.thumbnails ? 0 : clampFrameNumber(&pool.rom.frames, slot->imagemeta2.border) + 1;
+	const uint8_t *data = NULL, *unframedData = NULL;
+	size_t len = 0, unframedLen = 0, bytes;
+	bool ok;
+
+	if (pool.verify && job->report.slots[slotNum-1].trust == GBCAM_TRUST_BAD) {
+		warnx("%s: slot %d failed verification, skipped", job->path, slotNum);
+		w->stats.skippedSlots++;
 		return true;
+	}
+
+	Stats_Begin(&c);
+	slotStart = c;
+	snprintf(fmt, sizeof(fmt), "%s_%%02d%s.%s", picNum ? "IMG" : "DEL",
+		pool.thumbnails ? "_thumb" : "", ImageEncoder_Extension(pool.format));
+	jobPath(filename, sizeof(filename), job, fmt, picNum ? picNum : slotNum);
+
+	// Each slot has its own state entry, so no locking is needed here.
+	if (pool.incremental) {
+		key = slotKey(job, slotNum, filename);
+		if (key == state->input && outputIntact(filename, state)) {
+			w->stats.skippedSlots++;
+			return true;
+		}
+		state->input = 0;
+		__atomic_store_n(&job->stateChanged, true, __ATOMIC_RELAXED);
+	}
+
+	// Blank and copied photos are found in the memo, and not decoded.
+	if (pool.useMemo) {
+		if (EncodeMemo_Get(&pool.memo, input, inputLen, tag, &data, &len))
+			w->stats.memoHits++;
+		if (pool.unframed && EncodeMemo_Get(&pool.memo, input, inputLen, -1, &unframedData, &unframedLen))
+			w->stats.memoHits++;
+	}
+	if (!data || (pool.unframed && !unframedData)) {
+		decodeImage(w, job, slotNum, &width, &height, &stride);
+		Stats_End(&w->stats.stages[STATS_DECODE], &c);
+	}
+
+	if (!data) {
+		if (!encodeImage(w, input, inputLen, tag, w->pixelBuffer, width, height, stride, &data, &len)) {
+			warnx("couldn't encode '%s'", filename);
+			return false;
+		}
+		Stats_End(&w->stats.stages[STATS_ENCODE], &c);
+	}
+	ok = writeImage(w, filename, data, len, &bytes);
+	Stats_End(&w->stats.stages[STATS_WRITE], &c);
+	w->stats.rawBytes += pool.thumbnails ? GBCAM_THUMB_SIZE : GBCAM_IMAGE_SIZE;
+	w->stats.bytesOut += bytes;
+	w->stats.slotBytes[slotNum-1] += bytes;
+
+	// A name that doesn't fit isn't recorded, so the slot is written again
+	// next time rather than never matching.
+	if (pool.incremental && ok) {
+		const char *base = strrchr(filename, '/');
+		base = base ? base + 1 : filename;
+		if (strlen(base) < sizeof(state->name)) {
+			state->input = key;
+			state->output = hash64(data, len, 0);
+			state->size = len;
+			memcpy(state->name, base, strlen(base) + 1);
+		} else {
+			warnx("'%s': name too long for the state file", base);
+		}
+	}
+
+	// The photo without its frame is the middle of the framed image, so
+	// it is encoded from the same buffer, without decoding it again.
+	if (pool.unframed && ok) {
+		snprintf(fmt, sizeof(fmt), "%s_%%02d_unframed.%s", picNum ? "IMG" : "DEL",
+			ImageEncoder_Extension(pool.format));
+		jobPath(filename, sizeof(filename), job, fmt, picNum ? picNum : slotNum);
+		if (!unframedData) {
+			if (!encodeImage(w, input, inputLen, -1,
+				w->pixelBuffer + GBCAM_PHOTO_Y * stride + GBCAM_PHOTO_X / 4,
+				GBCAM_PHOTO_WIDTH, GBCAM_PHOTO_HEIGHT, stride, &unframedData, &unframedLen)) {
+				warnx("couldn't encode '%s'", filename);
+				return false;
+			}
+			Stats_End(&w->stats.stages[STATS_ENCODE], &c);
+		}
+		ok = writeImage(w, filename, unframedData, unframedLen, &bytes);
+		Stats_End(&w->stats.stages[STATS_WRITE], &c);
+		w->stats.rawBytes += GBCAM_PHOTO_WIDTH / 4 * GBCAM_PHOTO_HEIGHT;
+		w->stats.bytesOut += bytes;
+		w->stats.slotBytes[slotNum-1] += bytes;
+	}
+	Stats_End(&w->stats.slots[slotNum-1], &slotStart);
+
+	if (picNum)
+		w->stats.activeSlots++;
 	else
-		return false;
+		w->stats.deletedSlots++;
+	return ok;
 }
 
-uint8_t *getFrame(uint8_t rom[], int frameNumber)
+// With -S a slot's image goes into the store under its key instead, and
+// the save's manifest points at it. An image that is already there is
+// neither decoded nor encoded again, unless it is to be verified.
+static bool storeSlot(struct Worker_s *w, struct SaveJob_s *job, int slotNum)
 {
-	int frameAddress;
+	const struct slot_s *slot = (const struct slot_s *)(job->save.data + (slotNum + 1) * 0x1000);
+	struct StoreRef_s *ref = &job->objects[slotNum-1];
+	const char *ext = ImageEncoder_Extension(pool.format);
+	uint64_t key = imageKey(job, slotNum);
+	struct StatsClock_s c = {0}, slotStart;
+	int width, height, stride;
+	const uint8_t *input = pool.thumbnails ? slot->thumbnail : slot->image;
+	size_t inputLen = pool.thumbnails ? sizeof(slot->thumbnail) : sizeof(slot->image);
+	int tag = pool.thumbnails ? 0 : clampFrameNumber(&pool.rom.frames, slot->imagemeta2.border) + 1;
+	const uint8_t *data = NULL;
+	size_t len = 0;
+	bool ok;
 
-	if (!rom) {
-		return NULL;
+	if (pool.verify && job->report.slots[slotNum-1].trust == GBCAM_TRUST_BAD) {
+		warnx("%s: slot %d failed verification, skipped", job->path, slotNum);
+		w->stats.skippedSlots++;
+		return true;
 	}
 
-	if (isHkRom(rom))
-	{
-		// validate the frame number, hello kitty version has 25 frames
-		if( frameNumber < 0 || frameNumber >= 25 )
-			frameNumber = 24;
+	// Each slot has its own manifest line, so no locking is needed here.
+	ref->picture = GbCam_SlotPicture(&job->save, slotNum);
+	if (!pool.store.verify && Store_Find(&pool.store, key, ext, ref->name, sizeof(ref->name))) {
+		w->stats.skippedSlots++;
+		return true;
+	}
 
-		// retrieve the border address
-		frameAddress = HELLO_KITTY_FRAME_OFFSETS[frameNumber][0];
+	Stats_Begin(&c);
+	slotStart = c;
+	if (pool.useMemo && EncodeMemo_Get(&pool.memo, input, inputLen, tag, &data, &len))
+		w->stats.memoHits++;
+	if (!data) {
+		decodeImage(w, job, slotNum, &width, &height, &stride);
+		Stats_End(&w->stats.stages[STATS_DECODE], &c);
+		if (!encodeImage(w, input, inputLen, tag, w->pixelBuffer, width, height, stride, &data, &len)) {
+			warnx("%s: couldn't encode slot %d", job->path, slotNum);
+			*ref->name = '\0';
+			return false;
+		}
+		Stats_End(&w->stats.stages[STATS_ENCODE], &c);
 	}
+	ok = Store_Put(&pool.store, key, ext, data, len, ref->name, sizeof(ref->name));
+	if (!ok)
+		*ref->name = '\0';
+	Stats_End(&w->stats.stages[STATS_WRITE], &c);
+	Stats_End(&w->stats.slots[slotNum-1], &slotStart);
+	w->stats.rawBytes += pool.thumbnails ? GBCAM_THUMB_SIZE : GBCAM_IMAGE_SIZE;
+	w->stats.bytesOut += len;
+	w->stats.slotBytes[slotNum-1] += len;
+
+	if (ref->picture)
+		w->stats.activeSlots++;
 	else
-	{
-		// validate the frame number
-		if (frameNumber < 0 || frameNumber >= 18)
-			frameNumber = 13;
-
-		// calculate the border address.
-		// it can be in one of two banks.
-		if(frameNumber < 9)
-			frameAddress = BANK(0x34) + frameNumber * 0x688;
+		w->stats.deletedSlots++;
+	return ok;
+}
+
+// Without a rom the border is blank, so sheet cells are just the photo.
+static void sheetCellSize(int *width, int *height)
+{
+	bool framed = pool.rom.frames.numFrames != 0;
+	if (pool.thumbnails) {
+		*width = GBCAM_THUMB_WIDTH;
+		*height = GBCAM_THUMB_HEIGHT;
+		return;
+	}
+	*width = framed ? WIDTH : 128;
+	*height = framed ? HEIGHT : 112;
+}
+
+// Compose every slot of a save into one grid image and encode it once.
+// Photos come first in album order, then deleted slots; sheet.txt says
+// which slot and picture number ended up in which cell.
+static bool extractSheet(struct Worker_s *w, struct SaveJob_s *job)
+{
+	struct GbCam_SlotInfo_s slots[GBCAM_NUM_SLOTS];
+	int order[GBCAM_NUM_SLOTS], n = 0;
+	int cellWidth, cellHeight, cellRowSize, sheetRowSize, rows;
+	int x0, y0, width, height, stride;
+	char filename[PATH_MAX], fmt[32];
+	char index[30 * 48 + 64];
+	int indexLen;
+	struct StatsClock_s c = {0}, slotStart;
+	size_t bytes;
+	bool ok;
+
+	sheetCellSize(&cellWidth, &cellHeight);
+	cellRowSize = cellWidth / 4;
+	sheetRowSize = cellRowSize * pool.sheetColumns;
+	rows = (30 + pool.sheetColumns - 1) / pool.sheetColumns;
+
+	GbCam_ListSlots(&job->save, slots);
+	for (int picNum = 1; picNum <= 30; ++picNum)
+		for (int i = 0; i < GBCAM_NUM_SLOTS; ++i)
+			if (slots[i].picture == picNum)
+				order[n++] = slots[i].slot;
+	for (int i = 0; i < GBCAM_NUM_SLOTS; ++i)
+		if (!slots[i].picture)
+			order[n++] = slots[i].slot;
+
+	memset(w->sheet, 0, sheetRowSize * cellHeight * rows);
+	indexLen = snprintf(index, sizeof(index), "# cell slot pic x y width height\n");
+	for (int cell = 0; cell < n; ++cell) {
+		int slotNum = order[cell];
+		int picNum = slots[slotNum-1].picture ? slots[slotNum-1].picture : -1;
+		int col = cell % pool.sheetColumns, row = cell / pool.sheetColumns;
+		uint8_t *dst = w->sheet + row * cellHeight * sheetRowSize + col * cellRowSize;
+
+		// A slot that fails verification is left as a black cell.
+		if (pool.verify && job->report.slots[slotNum-1].trust == GBCAM_TRUST_BAD) {
+			warnx("%s: slot %d failed verification, skipped", job->path, slotNum);
+			w->stats.skippedSlots++;
+			continue;
+		}
+		Stats_Begin(&c);
+		slotStart = c;
+		decodeImage(w, job, slotNum, &width, &height, &stride);
+		x0 = (width - cellWidth) / 8;
+		y0 = (height - cellHeight) / 2;
+		for (int y = 0; y < cellHeight; ++y)
+			memcpy(dst + y * sheetRowSize, w->pixelBuffer + (y0 + y) * stride + x0, cellRowSize);
+		Stats_End(&w->stats.stages[STATS_DECODE], &c);
+		Stats_End(&w->stats.slots[slotNum-1], &slotStart);
+		if (picNum > 0)
+			w->stats.activeSlots++;
 		else
-			frameAddress = BANK(0x35) + (frameNumber - 9) * 0x688;
+			w->stats.deletedSlots++;
+		indexLen += snprintf(index + indexLen, sizeof(index) - indexLen,
+			"%d %d %d %d %d %d %d\n", cell, slotNum, picNum,
+			col * cellWidth, row * cellHeight, cellWidth, cellHeight);
 	}
 
-	return &rom[frameAddress];
+	snprintf(fmt, sizeof(fmt), "sheet.%s", ImageEncoder_Extension(pool.format));
+	jobPath(filename, sizeof(filename), job, fmt, 0);
+	Stats_Begin(&c);
+	if (!ImageEncoder_Encode(&w->enc, w->sheet, cellWidth * pool.sheetColumns, cellHeight * rows, sheetRowSize)) {
+		warnx("couldn't encode '%s'", filename);
+		return false;
+	}
+	Stats_End(&w->stats.stages[STATS_ENCODE], &c);
+	w->stats.rawBytes += sheetRowSize * cellHeight * rows;
+	if (!writeImage(w, filename, w->enc.out, w->enc.outLen, &bytes))
+		return false;
+	w->stats.bytesOut += bytes + indexLen;
+	jobPath(filename, sizeof(filename), job, "sheet.txt", 0);
+	ok = Output_Write(&pool.out, filename, (const uint8_t *)index, indexLen);
+	Stats_End(&w->stats.stages[STATS_WRITE], &c);
+	return ok;
 }
 
-static inline int picNum2BaseAddress(int picNum)
+// Describe what failed in a pair of blocks.
+static int describePair(char *dst, size_t len, const char *what,
+	const struct GbCam_BlockCheck_s c[2], bool copiesMatch)
 {
-	// Picture 1 is at 0x2000, picture 2 is at 0x3000, etc.
-	return (picNum + 1) * 0x1000;
+	return snprintf(dst, len, " %s:%s%s%s%s%s", what,
+		c[0].magic ? "" : " primary-magic", c[0].checksum ? "" : " primary-checksum",
+		c[1].magic ? "" : " backup-magic", c[1].checksum ? "" : " backup-checksum",
+		copiesMatch ? "" : " copies-differ");
 }
 
-void convert(uint8_t rom[], uint8_t saveBuffer[], uint8_t pixelBuffer[], int picNum)
+// The integrity report for a save: a summary line, then a line for each
+// slot that isn't fully ok. Fails if any slot, or the album, is bad.
+static bool checkSave(struct SaveJob_s *job)
 {
-	int baseAddress = picNum2BaseAddress(picNum);
-	int frameNumber = saveBuffer[baseAddress + 0xfb0];
-	uint8_t *frameAddress = getFrame(rom, frameNumber);
-	int xTile, yTile, tileNum, x, y, z;
-	uint8_t *tile;
+	const struct GbCam_Report_s *r = &job->report;
+	char text[30 * 160 + PATH_MAX + 256];
+	int len;
 
-	for (yTile = 0; yTile < 14; ++yTile)
-	{
-		y = 16 + yTile*8;
-		x = 16;
-		tile = saveBuffer + baseAddress + yTile*256;
-		for (x = 16; x <= 8*17; tile+=16, x+=8)
-		{
-			drawSpan(pixelBuffer, tile, x, y);
-		}
+	len = snprintf(text, sizeof(text), "%s: album %s; slots: %d ok, %d backup differs, "
+		"%d backup used, %d unverified, %d bad\n", job->path, GbCam_TrustName(r->album),
+		r->counts[GBCAM_TRUST_OK], r->counts[GBCAM_TRUST_PRIMARY], r->counts[GBCAM_TRUST_BACKUP],
+		r->counts[GBCAM_TRUST_UNVERIFIED], r->counts[GBCAM_TRUST_BAD]);
+	if (r->album != GBCAM_TRUST_OK) {
+		len += snprintf(text + len, sizeof(text) - len, "%s: album", job->path);
+		len += describePair(text + len, sizeof(text) - len, "order", r->albumChecks, r->albumCopiesMatch);
+		len += snprintf(text + len, sizeof(text) - len, "\n");
+	}
+	for (int i = 0; i < GBCAM_NUM_SLOTS; ++i) {
+		const struct GbCam_SlotReport_s *s = &r->slots[i];
+		if (s->trust == GBCAM_TRUST_OK)
+			continue;
+		len += snprintf(text + len, sizeof(text) - len, "%s: slot %d %s;", job->path, i + 1, GbCam_TrustName(s->trust));
+		if (s->image != GBCAM_TRUST_OK)
+			len += describePair(text + len, sizeof(text) - len, "image", s->imageChecks, s->imageCopiesMatch);
+		if (s->user != GBCAM_TRUST_OK)
+			len += describePair(text + len, sizeof(text) - len, "user", s->userChecks, s->userCopiesMatch);
+		len += snprintf(text + len, sizeof(text) - len, "\n");
+	}
+	return Output_WriteStream(&pool.out, text, len)
+		&& r->album != GBCAM_TRUST_BAD && !r->counts[GBCAM_TRUST_BAD];
+}
 
-		if (rom) {
-			// Draw the sides of the frame
-			y = 16 + yTile*8;
-			for (z=0; z<4; ++z)
-			{
-				if (isHkRom(rom)) {
-					tileNum = rom[HELLO_KITTY_FRAME_OFFSETS[frameNumber][1] + 0x50 + yTile*4 + z];
-				} else {
-					tileNum = getFrame(rom, frameNumber)[0x650 + yTile*4 + z];
-				}
-				tile = getFrame(rom, frameNumber) +  tileNum*16;
-				x = ((z&1)?8:0) + ((z&2)?HEIGHT:0);
-				drawSpan(pixelBuffer, tile, x, y);
-			}
-		}
+// The metadata of every slot of a save, as one block of index records.
+static bool extractMetadata(struct Worker_s *w, struct SaveJob_s *job)
+{
+	struct StatsClock_s c = {0};
+	bool ok;
+
+	Stats_Begin(&c);
+	w->index.len = 0;
+	MetaIndex_AddSave(&w->index, job->path, &job->save);
+	Stats_End(&w->stats.stages[STATS_DECODE], &c);
+	ok = Output_WriteStream(&pool.out, w->index.buf, w->index.len);
+	Stats_End(&w->stats.stages[STATS_WRITE], &c);
+	w->stats.bytesOut += w->index.len;
+	return ok;
+}
+
+// Each worker owns its pixel buffer and image encoder state, and pulls one
+// slot at a time from the shared cursor (or a whole save, when making
+// contact sheets). With one worker this is the serial path.
+static void *worker(void *arg)
+{
+	struct Worker_s *w = calloc(1, sizeof(*w));
+	if (!w) err(1, "malloc failure");
+
+	ImageEncoder_Init(&w->enc, pool.format);
+	w->enc.png.useLibpng = !pool.builtinPng;
+	w->enc.png.profile = pool.profile;
+	MetaIndex_Init(&w->index, pool.metaFormat);
+	if (pool.sheetColumns) {
+		int cellWidth, cellHeight;
+		int rows = (30 + pool.sheetColumns - 1) / pool.sheetColumns;
+		sheetCellSize(&cellWidth, &cellHeight);
+		w->sheet = malloc((cellWidth / 4) * cellHeight * pool.sheetColumns * rows);
+		if (!w->sheet) err(1, "malloc failure");
 	}
 
-	if (rom) {
-		// Draw the top and bottom of the frame
-		for (xTile=0; xTile<20; ++xTile) for (z=0; z<4; ++z)
-		{
-			if (isHkRom(rom)) {
-				tileNum = rom[HELLO_KITTY_FRAME_OFFSETS[frameNumber][1] + xTile + 0x14*z];
+	for (;;) {
+		struct SaveJob_s *job;
+		int slotNum;
+		bool ok, last;
+
+		pthread_mutex_lock(&pool.lock);
+		while (!pool.cur) {
+			size_t rel;
+			char *path;
+
+			if (pool.numOpen >= pool.maxOpen) {
+				pthread_cond_wait(&pool.opened, &pool.lock);
+				continue;
+			}
+			path = nextSavePath(&rel);
+			if (!path) {
+				if (pool.scanning && Scan_Work(&pool.scan, &pool.lock))
+					continue;
+				if (!pool.opening)
+					break;
+				// Another worker's save may still have slots for us.
+				pthread_cond_wait(&pool.opened, &pool.lock);
+				continue;
+			}
+			// The save is claimed here, in order, but opened with the
+			// lock released, so that the others needn't wait on its I/O.
+			job = newSaveJob(path, rel);
+			pool.numOpen++;
+			pool.opening++;
+			pthread_mutex_unlock(&pool.lock);
+			ok = openSaveJob(job, &w->stats);
+			pthread_mutex_lock(&pool.lock);
+			pool.opening--;
+			if (ok) {
+				if (pool.cur)
+					pool.last->next = job;
+				else
+					pool.cur = job;
+				pool.last = job;
 			} else {
-				tileNum = getFrame(rom, frameNumber)[0x600 + xTile + 0x14*z];
+				pool.numOpen--;
+				pool.failures++;
 			}
+			pthread_cond_broadcast(&pool.opened);
+		}
+		job = pool.cur;
+		if (!job) {
+			pthread_mutex_unlock(&pool.lock);
+			break;
+		}
+		slotNum = job->nextSlot;
+		job->nextSlot = nextTodo(job, slotNum);
+		if (pool.sheetColumns || pool.metaFormat || pool.check)
+			job->nextSlot = 31;
+		job->refs++;
+		if (job->nextSlot > 30) {
+			// Drop the queue's reference; this worker still holds one.
+			pool.cur = job->next;
+			job->refs--;
+		}
+		pthread_mutex_unlock(&pool.lock);
+
+		if (pool.check)
+			ok = checkSave(job);
+		else if (pool.metaFormat)
+			ok = extractMetadata(w, job);
+		else if (pool.sheetColumns)
+			ok = extractSheet(w, job);
+		else if (pool.useStore)
+			ok = storeSlot(w, job, slotNum);
+		else
+			ok = extractSlot(w, job, slotNum);
+
+		pthread_mutex_lock(&pool.lock);
+		if (!ok)
+			job->failed = true;
+		last = !--job->refs;
+		pthread_mutex_unlock(&pool.lock);
+		if (last)
+			closeSaveJob(job);
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	Stats_Add(&pool.stats, &w->stats);
+	pthread_mutex_unlock(&pool.lock);
+
+	ImageEncoder_Free(&w->enc);
+	MetaIndex_Free(&w->index);
+	free(w->sheet);
+	free(w->recolored);
+	free(w);
+	return NULL;
+}
+
+// Returns the next save to extract, or NULL when there are none left.
+// Called with pool.lock held.
+static char *nextSavePath(size_t *rel)
+{
+	char *path;
+
+	*rel = 0;
+	if (pool.single) {
+		path = strdup(pool.single);
+		pool.single = NULL;
+		return path;
+	}
+	if (pool.argv && *pool.argv)
+		return strdup(*pool.argv++);
+	while (pool.list && (path = readPath(pool.list, pool.delim)) != NULL) {
+		if (*path)
+			return path;
+		free(path);
+	}
+	if (pool.scanning)
+		return Scan_Next(&pool.scan, rel);
+	return NULL;
+}
+
+// Adds key to the set of output directories used so far. Returns false if
+// it was already there. Called with pool.lock held.
+static bool addDirKey(uint64_t key)
+{
+	size_t i;
+
+	key = key ? key : 1;
+	if (2 * (pool.numDirKeys + 1) > pool.dirKeysCap) {
+		size_t cap = pool.dirKeysCap ? pool.dirKeysCap * 2 : 1024;
+		uint64_t *keys = calloc(cap, sizeof(*keys));
+		if (!keys) err(1, "malloc failure");
+		for (size_t j = 0; j < pool.dirKeysCap; ++j) {
+			if (!pool.dirKeys[j])
+				continue;
+			for (i = pool.dirKeys[j] & (cap - 1); keys[i]; i = (i + 1) & (cap - 1))
+				;
+			keys[i] = pool.dirKeys[j];
+		}
+		free(pool.dirKeys);
+		pool.dirKeys = keys;
+		pool.dirKeysCap = cap;
+	}
+	for (i = key & (pool.dirKeysCap - 1); pool.dirKeys[i]; i = (i + 1) & (pool.dirKeysCap - 1))
+		if (pool.dirKeys[i] == key)
+			return false;
+	pool.dirKeys[i] = key;
+	pool.numDirKeys++;
+	return true;
+}
+
+// Saves with the same name in different directories (a/cam.sav and
+// b/cam.sav) would get the same output directory, and write over each
+// other. The first keeps the name; the next gets "-2" added, then "-3",
+// and so on. Called with pool.lock held, in the order the saves are
+// given, so the names don't depend on -j.
+static void claimOutputDir(char *dir, size_t len, const char *filename_save)
+{
+	char base[PATH_MAX];
+
+	if (addDirKey(hash64(dir, strlen(dir), 0)))
+		return;
+	snprintf(base, sizeof(base), "%s", dir);
+	for (int n = 2; ; ++n) {
+		snprintf(dir, len, "%s-%d", base, n);
+		if (addDirKey(hash64(dir, strlen(dir), 0)))
+			break;
+	}
+	warnx("%s: '%s' is already used by another save, writing to '%s'", filename_save, base, dir);
+}
+
+// Takes filename_save, and picks the save's output directory. Called with
+// pool.lock held. rel is nonzero for a save found by -R, and is where the
+// part of its path below the scanned directory starts.
+static struct SaveJob_s *newSaveJob(char *filename_save, size_t rel)
+{
+	struct SaveJob_s *job = calloc(1, sizeof(*job));
+	if (!job) err(1, "malloc failure");
+
+	job->path = filename_save;
+	job->nested = rel != 0;
+	if (pool.out.kind != OUTPUT_FILES)
+		saveOutputDir(job->dir, sizeof(job->dir), NULL, pool.batch ? filename_save : NULL, rel);
+	else if (pool.batch)
+		saveOutputDir(job->dir, sizeof(job->dir), pool.outdir, filename_save, rel);
+	else
+		snprintf(job->dir, sizeof(job->dir), "%s", pool.outdir);
+	if (pool.batch && !pool.metaFormat && !pool.check)
+		claimOutputDir(job->dir, sizeof(job->dir), filename_save);
+	return job;
+}
+
+// Opens the save and its output directory. Called without pool.lock, since
+// all of this is I/O. On failure the job is freed.
+static bool openSaveJob(struct SaveJob_s *job, struct Stats_s *stats)
+{
+	char *filename_save = job->path;
+	struct StatsClock_s c = {0};
+
+	Stats_Begin(&c);
+	// Open the save file.
+	job->m = MappedFile_Open(filename_save, false);
+	if (!job->m.data) {
+		warn("couldn't open save '%s' for reading", filename_save);
+		goto out_free;
+	}
+
+	switch (GbCam_OpenSave(&job->save, job->m.data, job->m.size)) {
+	case GBCAM_OK:
+		break;
+	case GBCAM_ESIZE:
+		warnx("%s: savegame has weird size", filename_save);
+		goto out_error;
+	default:
+		// Check if the save that we read is actually a rom.
+		warnx("%s: save expected, but rom was given", filename_save);
+		goto out_error;
+	}
+
+	if (pool.out.kind == OUTPUT_FILES && !pool.metaFormat && !pool.check
+	 && !(job->nested ? makeDirs(job->dir) : makeDir(job->dir))) {
+		warn("couldn't create output directory '%s'", job->dir);
+		goto out_error;
+	}
+	if (pool.verify || pool.check)
+		GbCam_VerifySave(&job->save, &job->report);
+	if (pool.verify && job->report.album == GBCAM_TRUST_BAD)
+		warnx("%s: album order is corrupt, picture numbers may be wrong", filename_save);
+	if (pool.incremental) {
+		StateFile_Load(job->dir, job->state);
+		for (int i = 0; i < 30; ++i)
+			memcpy(job->oldNames[i], job->state[i].name, sizeof(job->oldNames[i]));
+	}
+
+	job->todo = ~0u;
+	job->nextSlot = 1;
+	job->refs = 1;
+	Stats_End(&stats->stages[STATS_OPEN], &c);
+	stats->saves++;
+	stats->bytesIn += job->m.size;
+	return true;
+
+out_error:
+	MappedFile_Close(job->m);
+out_free:
+	free(job->path);
+	free(job);
+	return false;
+}
+
+// Remove files written by an earlier incremental run that no slot writes
+// any more, such as the IMG file of a picture that has since been deleted.
+static void pruneOldFiles(const struct SaveJob_s *job)
+{
+	char filename[PATH_MAX];
+
+	for (int i = 0; i < 30; ++i) {
+		bool current = !*job->oldNames[i];
+		for (int j = 0; j < 30 && !current; ++j)
+			current = !strcmp(job->oldNames[i], job->state[j].name);
+		if (current || strchr(job->oldNames[i], '/') || job->oldNames[i][0] == '.')
+			continue;
+		snprintf(filename, sizeof(filename), "%s%s%s", job->dir, *job->dir ? "/" : "", job->oldNames[i]);
+		remove(filename);
+	}
+}
+
+// The first slot after slotNum that is still to do, or 31 if there is none.
+// Called with pool.lock held.
+static int nextTodo(const struct SaveJob_s *job, int slotNum)
+{
+	while (++slotNum <= 30 && !(job->todo & 1u << slotNum))
+		;
+	return slotNum;
+}
+
+// Called by the worker that finished the save's last slot, without
+// pool.lock, since all of this but the counters at the end is I/O.
+static void closeSaveJob(struct SaveJob_s *job)
+{
+	int failures = job->failed, stateFailures = 0;
+	bool keep = job->keep;
+
+	if (job->stateChanged) {
+		pruneOldFiles(job);
+		// Without it the next run would redo everything, so this
+		// counts as a failure even though the images were written.
+		if (!StateFile_Store(job->dir, job->state))
+			stateFailures++;
+	}
+	if (pool.useStore && !Store_WriteManifest(&pool.store, job->dir, job->objects))
+		failures++;
+	if (keep) {
+		// What this pass wrote is what the next one may have to prune.
+		for (int i = 0; i < 30; ++i)
+			memcpy(job->oldNames[i], job->state[i].name, sizeof(job->oldNames[i]));
+	} else {
+		MappedFile_Close(job->m);
+		free(job->path);
+		free(job);
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	pool.failures += failures + stateFailures;
+	pool.stateFailures += stateFailures;
+	if (!keep) {
+		pool.numOpen--;
+		pthread_cond_broadcast(&pool.opened);
+	}
+	pthread_mutex_unlock(&pool.lock);
+}
 
-			tile = frameAddress + tileNum*16;
-			x = xTile*8;
-			y = ((z&1)?8:0) + ((z&2)?128:0);
-			drawSpan(pixelBuffer, tile, x, y);
+// Read one path from a list file, up to delim or EOF. Returns NULL at EOF.
+static char *readPath(FILE *f, int delim)
+{
+	size_t len = 0, cap = 256;
+	char *path = malloc(cap);
+	int c;
+
+	if (!path) err(1, "malloc failure");
+	while ((c = fgetc(f)) != EOF && c != delim) {
+		if (len + 1 >= cap) {
+			char *p = realloc(path, cap *= 2);
+			if (!p) err(1, "malloc failure");
+			path = p;
 		}
+		path[len++] = c;
+	}
+	if (c == EOF && len == 0) {
+		free(path);
+		return NULL;
 	}
+	// Tolerate CRLF line endings in list files.
+	if (delim == '\n' && len && path[len-1] == '\r')
+		len--;
+	path[len] = '\0';
+	return path;
 }
 
-static inline unsigned int interleaveBytes(uint8_t low, uint8_t high)
-{
-	int result;
-	// We recieve two vars, each 8 bits in length
-	// We return one int, 16 bits in length, that contains the two vars interleaved
-	// example:
-	//    low = 00000000
-	//   high = 11111111
-	// result = 10101010 10101010
+static bool makeDir(const char *path)
+{
+#ifdef __MINGW32__
+	if (mkdir(path) == 0 || errno == EEXIST)
+#else
+	if (mkdir(path, 0777) == 0 || errno == EEXIST)
+#endif
+		return true;
+	return false;
+}
 
-	result  = low & 1;
-	result |= (high & 1) << 1;
-	result |= (low & 2) << 1;
-	result |= (high & 2) << 2;
-	result |= (low & 4) << 2;
-	result |= (high & 4) << 3;
-	result |= (low & 8) << 3;
-	result |= (high & 8) << 4;
+// makeDir, and the directories above path that aren't there yet.
+static bool makeDirs(char *path)
+{
+	for (char *p = path + 1; *p; ++p)
+		if (*p == '/') {
+			bool ok;
+			*p = '\0';
+			ok = makeDir(path);
+			*p = '/';
+			if (!ok)
+				return false;
+		}
+	return makeDir(path);
+}
 
-	result |= (low & 16) << 4;
-	result |= (high & 16) << 5;
-	result |= (low & 32) << 5;
-	result |= (high & 32) << 6;
-	result |= (low & 64) << 6;
-	result |= (high & 64) << 7;
-	result |= (low & 128) << 7;
-	result |= (high & 128) << 8;
+// The output directory for a save is its file name without the extension.
+// With no outdir the result is relative, and with no save it is empty. A
+// save found by -R keeps its path below the scanned directory, from rel.
+static void saveOutputDir(char *dst, size_t len, const char *outdir, const char *filename_save, size_t rel)
+{
+	const char *base = filename_save, *p, *dot;
+	int baseLen;
 
-	return result;
+	if (!filename_save) {
+		snprintf(dst, len, "%s", outdir ? outdir : "");
+		return;
+	}
+	for (p = filename_save; *p; ++p)
+		if (*p == '/' || *p == '\\')
+			base = p + 1;
+	dot = strrchr(base, '.');
+	baseLen = (dot && dot != base) ? (int)(dot - base) : (int)strlen(base);
+	if (rel) {
+		baseLen += base - (filename_save + rel);
+		base = filename_save + rel;
+	}
+	if (outdir)
+		snprintf(dst, len, "%s/%.*s", outdir, baseLen, base);
+	else
+		snprintf(dst, len, "%.*s", baseLen, base);
+}
+
+// Path of one of a save's output files; fmt may take one int.
+static void jobPath(char *dst, size_t len, const struct SaveJob_s *job, const char *fmt, int n)
+{
+	char name[64];
+
+	snprintf(name, sizeof(name), fmt, n);
+	if (*job->dir)
+		snprintf(dst, len, "%s/%s", job->dir, name);
+	else
+		snprintf(dst, len, "%s", name);
 }
 
-void drawSpan(uint8_t pixelBuffer[], uint8_t *buffer, int x, int y) {
-	unsigned int interleaved;
-	uint8_t lowBits, highBits;
-	uint8_t *p, *q;
-	p = pixelBuffer + (x/4) + y * ROW_SIZE;
-	for (q = p + ROW_SIZE * 8; p<q; p+=ROW_SIZE)
-	{
-		lowBits = ~*buffer++;
-		highBits = ~*buffer++;
-		interleaved = interleaveBytes(lowBits, highBits);
-		p[1] = (uint8_t)(interleaved);
-		p[0] = (uint8_t)(interleaved >> 8);
+// Run the workers until there are no saves left. With one worker this is
+// the serial path.
+static void runWorkers(int numThreads)
+{
+	pool.maxOpen = numThreads + 1;
+	if (numThreads == 1) {
+		worker(NULL);
+	} else {
+		pthread_t *threads = calloc(numThreads, sizeof(pthread_t));
+		if (!threads) err(1, "malloc failure");
+		for (int i = 0; i < numThreads; ++i)
+			if ((errno = pthread_create(&threads[i], NULL, worker, NULL)))
+				err(1, "couldn't start worker thread");
+		for (int i = 0; i < numThreads; ++i)
+			pthread_join(threads[i], NULL);
+		free(threads);
 	}
 }
 
-void writeImageFile(uint8_t pixelBuffer[], const char *filename)
+#ifdef __linux__
+// Which slots differ between two copies of a save. The album order is in
+// the header, and a change there can rename any slot, so it marks them all.
+static uint32_t changedSlots(const uint8_t *old, const uint8_t *cur)
 {
-	int y;
-	// open file
-	FILE *fp = fopen(filename, "wb");
+	uint32_t todo = 0;
 
-	png_structp png_ptr = png_create_write_struct
-		(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if (memcmp(old, cur, 0x2000))
+		return ~0u;
+	for (int i = 1; i <= 30; ++i)
+		if (memcmp(old + (i + 1) * 0x1000, cur + (i + 1) * 0x1000, 0x1000))
+			todo |= 1u << i;
+	return todo;
+}
 
-	if (!png_ptr)
-		exit(EXIT_FAILURE);
+// Map the save again, after a writer replaced the file with a new one. The
+// old mapping is kept if the new file can't be used.
+static bool remapSave(struct SaveJob_s *job, struct stat *mapped)
+{
+	struct MappedFile_s m = MappedFile_Open(job->path, false);
+	struct GbCam_Save_s save;
 
-	png_infop info_ptr = png_create_info_struct(png_ptr);
-	if (!info_ptr)
-	{
-		png_destroy_write_struct(&png_ptr, 
-				(png_infopp)NULL);
-		exit(EXIT_FAILURE);
+	if (!m.data) {
+		warn("couldn't open save '%s' for reading", job->path);
+		return false;
 	}
+	if (GbCam_OpenSave(&save, m.data, m.size) != GBCAM_OK || fstat(m._fd, mapped)) {
+		MappedFile_Close(m);
+		return false;
+	}
+	MappedFile_Close(job->m);
+	job->m = m;
+	job->save = save;
+	return true;
+}
 
-	// init output
-	png_init_io( png_ptr, fp );
-	png_set_compression_level(png_ptr, Z_BEST_COMPRESSION);
-	png_set_compression_mem_level(png_ptr, 9);
+// Extract the slots in job->todo from the watched save.
+static void watchPass(struct SaveJob_s *job, int numThreads)
+{
+	job->nextSlot = nextTodo(job, 0);
+	job->refs = 1;
+	job->failed = false;
+	job->stateChanged = false;
+	job->next = NULL;
+	pool.cur = pool.last = job;
+	runWorkers(numThreads);
+}
+#endif
 
-	// set header info
-	png_set_IHDR(png_ptr, info_ptr, WIDTH, HEIGHT, 2, 
-			PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+// Extract the save, then again every time it is written, until killed. The
+// save stays mapped, and its state stays in memory, from one pass to the
+// next; it is only mapped again when a new file is renamed over it. Each
+// write is compared with a copy of the save as it was, so only the slots
+// that changed are hashed and, if need be, encoded. A save caught
+// half-written (the wrong size) is left until the next write.
+static bool watchSave(const char *filename_save, int numThreads, int debounceMs)
+{
+#ifdef __linux__
+	struct Watch_s watch;
+	struct StatsClock_s t;
+	struct stat st, mapped;
+	struct SaveJob_s *job;
+	char *path = strdup(filename_save);
+	uint8_t *prev = malloc(GBCAM_SAVE_SIZE);
 
-	// setup row pointers
-	png_bytep *row_pointers = malloc(sizeof(png_bytep) * HEIGHT);
-	if (!row_pointers) err(1, "malloc failure");
-	for(y=0; y<HEIGHT; ++y)
-		row_pointers[y] = (png_byte *)(pixelBuffer + ROW_SIZE * y);
+	if (!path || !prev) err(1, "malloc failure");
+	if (!Watch_Open(&watch, filename_save)) {
+		free(path);
+		free(prev);
+		return false;
+	}
+	job = newSaveJob(path, 0);
+	if (!openSaveJob(job, &pool.stats)) {
+		Watch_Close(&watch);
+		free(prev);
+		return false;
+	}
+	job->keep = true;
+	pool.single = NULL;
+	if (fstat(job->m._fd, &mapped))
+		err(1, "couldn't stat '%s'", filename_save);
+	// The copy is taken before each pass, so a write that lands during
+	// the pass is still seen as a change afterwards.
+	memcpy(prev, job->m.data, GBCAM_SAVE_SIZE);
+	watchPass(job, numThreads);
+	for (;;) {
+		uint64_t encoded = pool.stats.activeSlots + pool.stats.deletedSlots;
 
-	// set rows
-	png_set_rows(png_ptr, info_ptr, row_pointers);
+		if (pool.stateFailures) {
+			// Every later update would re-encode the whole save.
+			warnx("%s: stopped watching, the state file can't be saved", filename_save);
+			break;
+		}
+		if (!Watch_Wait(&watch, debounceMs)) {
+			warn("couldn't watch '%s'", filename_save);
+			break;
+		}
+		if (stat(filename_save, &st) || st.st_size != GBCAM_SAVE_SIZE)
+			continue;
 
-	// write png
-	// png_write_png( png_ptr, info_ptr, 0, NULL );
-	png_write_info(png_ptr, info_ptr);
-	png_write_flush(png_ptr);
-	png_write_image(png_ptr, row_pointers);
+		Stats_Now(&t);
+		if ((st.st_ino != mapped.st_ino || st.st_dev != mapped.st_dev) && !remapSave(job, &mapped))
+			continue;
+		job->todo = changedSlots(prev, job->m.data);
+		if (!job->todo)
+			continue;
+		memcpy(prev, job->m.data, GBCAM_SAVE_SIZE);
+		watchPass(job, numThreads);
+		encoded = pool.stats.activeSlots + pool.stats.deletedSlots - encoded;
+		if (encoded) {
+			struct StatsClock_s now;
+			Stats_Now(&now);
+			fprintf(stderr, "%s: %d slot%s updated in %.1f ms\n", filename_save,
+				(int)encoded, encoded == 1 ? "" : "s", (now.wallNs - t.wallNs) / 1e6);
+		}
+	}
+	Watch_Close(&watch);
+	MappedFile_Close(job->m);
+	free(job->path);
+	free(job);
+	free(prev);
+	return false;
+#else
+	return false;
+#endif
+}
 
-	png_text source_text;
-	source_text.compression = PNG_TEXT_COMPRESSION_NONE;
-	source_text.key = "Source";
-	source_text.text = "Nintendo Gameboy Camera";
-	png_set_text(png_ptr, info_ptr, &source_text, 1);
+// The parts of an image key that are the same for every slot: the settings
+// that change the output, and a hash of each frame's template.
+static void initKeys(void)
+{
+	char settings[64];
 
-	source_text.key = "Software";
-	source_text.text = "gbcamextract";
-	png_set_text(png_ptr, info_ptr, &source_text, 1);
-
-	png_write_end(png_ptr, info_ptr);
-	png_destroy_write_struct(&png_ptr, &info_ptr);
-	if (row_pointers) free(row_pointers);
-
-	fclose(fp);
+	snprintf(settings, sizeof(settings), "%s %d %d %d", __progversion, pool.format, pool.builtinPng, pool.profile);
+	pool.settingsKey = hash64(settings, strlen(settings), 0);
+	for (int i = 0; i < pool.rom.frames.numFrames; ++i)
+		pool.frameKeys[i] = hashMix(hash64(FrameCache_Get(&pool.rom.frames, i), FRAME_TEMPLATE_SIZE, 0) + i);
 }
 
 static void usage(void)
 {
-	fprintf(stderr, "usage: %s [-r rom.gb] -s save.sav\n",
-		__progname
+	fprintf(stderr, "usage: %s [-j threads] [-f png|raw2|raw8|pgm|qoi] [-e libpng|builtin]\n"
+		"           [-p fast|balanced|smallest] [-P palette ...] [-a columns]\n"
+		"           [-t files|tar|zip [-O fd]] [-r rom.gb [-c]] [-u] [-o outdir]\n"
+		"           -s save.sav\n"
+		"       %s [-j threads] [-f png|raw2|raw8|pgm|qoi] [-e libpng|builtin]\n"
+		"           [-p fast|balanced|smallest] [-P palette ...] [-a columns]\n"
+		"           [-t files|tar|zip [-O fd]] [-r rom.gb [-c]] [-o outdir]\n"
+		"           [-l list [-0]] [-R] [-i] [-u] [-T] [--verify]\n"
+		"           [--stats[=text|json]] [save.sav|dir ...]\n"
+		"       %s [-j threads] [-f png|raw2|raw8|pgm|qoi] [-e libpng|builtin]\n"
+		"           [-p fast|balanced|smallest] [-r rom.gb [-c]] [-o outdir]\n"
+		"           [-l list [-0]] [-R] [-T] [--verify] [--stats[=text|json]]\n"
+		"           -S storedir [--store-verify] [save.sav|dir ...]\n"
+		"       %s [-j threads] [-O fd] [-l list [-0]] -m ndjson|binary [save.sav ...]\n"
+		"       %s [-j threads] [-O fd] [-l list [-0]] --check [save.sav ...]\n"
+		"       %s [-j threads] [-f png|raw2|raw8|pgm|qoi] [-e libpng|builtin]\n"
+		"           [-p fast|balanced|smallest] [-r rom.gb [-c]] [-o outdir]\n"
+		"           --watch[=ms] -s save.sav\n"
+		"       %s [-j threads] [-f png|raw2|raw8|pgm|qoi] [-e libpng|builtin]\n"
+		"           [-p fast|balanced|smallest] [-r rom.gb [-c]] -d socket\n"
+		"       %s -C socket [-t tar|zip] [-O fd] [-s save.sav|-]\n",
+		__progname, __progname, __progname, __progname, __progname, __progname, __progname, __progname
 	);
 	exit(EXIT_FAILURE);
 }
@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2013-2020 jkbenaim et al.
+ *
+ * This program is free software; you may redistribute and/or modify it under
+ * the terms of the expat license (also known as the "MIT license").
+ *
+ * This program is distributed in the hope that it will be useful, but without
+ * any warranty; without even the implied warranty of merchantability or
+ * firness for a particular purpose.
+ *
+ * For the full license text, see LICENSE.
+ *
+ ******************************************************************************
+ *
+ * This file implements the image formats the photos can be written in, each
+ * behind the same encode call: PNG, raw 2-bit and 8-bit pixels, PGM and QOI.
+ *
+ */
+
+#include "err_shim.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "imgenc.h"
+
+typedef bool (*EncodeFunc_t)(struct ImageEncoder_s *e, const uint8_t *pixels, int width, int height, int stride);
+
+static bool encodePng(struct ImageEncoder_s *e, const uint8_t *pixels, int width, int height, int stride);
+static bool encodeRaw2(struct ImageEncoder_s *e, const uint8_t *pixels, int width, int height, int stride);
+static bool encodeRaw8(struct ImageEncoder_s *e, const uint8_t *pixels, int width, int height, int stride);
+static bool encodePgm(struct ImageEncoder_s *e, const uint8_t *pixels, int width, int height, int stride);
+static bool encodeQoi(struct ImageEncoder_s *e, const uint8_t *pixels, int width, int height, int stride);
+
+static const struct {
+	const char *name;
+	const char *extension;
+	EncodeFunc_t encode;
+} formats[] = {
+	[IMAGE_FORMAT_PNG] = {"png", "png", encodePng},
+	[IMAGE_FORMAT_RAW2] = {"raw2", "raw2", encodeRaw2},
+	[IMAGE_FORMAT_RAW8] = {"raw8", "raw8", encodeRaw8},
+	[IMAGE_FORMAT_PGM] = {"pgm", "pgm", encodePgm},
+	[IMAGE_FORMAT_QOI] = {"qoi", "qoi", encodeQoi},
+};
+
+// Each byte of 2-bit pixels as four 8-bit ones.
+static uint8_t expand[256][4];
+static pthread_once_t expandOnce = PTHREAD_ONCE_INIT;
+
+static void buildExpand(void)
+{
+	for (int i = 0; i < 256; ++i)
+		for (int j = 0; j < 4; ++j)
+			expand[i][j] = ((i >> (6 - 2 * j)) & 3) * 0x55;
+}
+
+bool ImageEncoder_ParseFormat(const char *name, enum ImageFormat_e *format)
+{
+	for (int i = 0; i < NUM_IMAGE_FORMATS; ++i)
+		if (!strcmp(formats[i].name, name)) {
+			*format = i;
+			return true;
+		}
+	return false;
+}
+
+const char *ImageEncoder_Extension(enum ImageFormat_e format)
+{
+	return formats[format].extension;
+}
+
+void ImageEncoder_Init(struct ImageEncoder_s *e, enum ImageFormat_e format)
+{
+	memset(e, 0, sizeof(*e));
+	e->format = format;
+	PngEncoder_Init(&e->png);
+	pthread_once(&expandOnce, buildExpand);
+}
+
+static uint8_t *reserve(struct ImageEncoder_s *e, size_t need)
+{
+	if (need > e->_bufCap) {
+		free(e->_buf);
+		e->_buf = malloc(need);
+		if (!e->_buf) err(1, "malloc failure");
+		e->_bufCap = need;
+	}
+	return e->_buf;
+}
+
+static bool encodePng(struct ImageEncoder_s *e, const uint8_t *pixels, int width, int height, int stride)
+{
+	if (!PngEncoder_Encode(&e->png, pixels, width, height, stride))
+		return false;
+	e->out = e->png.out;
+	e->outLen = e->png.outLen;
+	return true;
+}
+
+// Rows that are already packed together are passed through untouched.
+static bool encodeRaw2(struct ImageEncoder_s *e, const uint8_t *pixels, int width, int height, int stride)
+{
+	size_t rowSize = width / 4;
+	uint8_t *p;
+
+	e->outLen = rowSize * height;
+	if (stride == rowSize) {
+		e->out = pixels;
+		return true;
+	}
+	p = reserve(e, e->outLen);
+	for (int y = 0; y < height; ++y)
+		memcpy(p + y * rowSize, pixels + y * stride, rowSize);
+	e->out = p;
+	return true;
+}
+
+static void expandRows(uint8_t *dst, const uint8_t *pixels, int width, int height, int stride)
+{
+	for (int y = 0; y < height; ++y) {
+		const uint8_t *row = pixels + y * stride;
+		for (int x = 0; x < width / 4; ++x, dst += 4)
+			memcpy(dst, expand[row[x]], 4);
+	}
+}
+
+static bool encodeRaw8(struct ImageEncoder_s *e, const uint8_t *pixels, int width, int height, int stride)
+{
+	uint8_t *p = reserve(e, (size_t)width * height);
+
+	expandRows(p, pixels, width, height, stride);
+	e->out = p;
+	e->outLen = (size_t)width * height;
+	return true;
+}
+
+static bool encodePgm(struct ImageEncoder_s *e, const uint8_t *pixels, int width, int height, int stride)
+{
+	char header[32];
+	int headerLen = snprintf(header, sizeof(header), "P5\n%d %d\n255\n", width, height);
+	uint8_t *p = reserve(e, headerLen + (size_t)width * height);
+
+	memcpy(p, header, headerLen);
+	expandRows(p + headerLen, pixels, width, height, stride);
+	e->out = p;
+	e->outLen = headerLen + (size_t)width * height;
+	return true;
+}
+
+static inline void put32be(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+// What four pixels (one byte) come to in QOI, given the pixel before them,
+// once all four grays are in the index. The pixels that repeat the one
+// before join the run already going; then come the ops, and the pixels at
+// the end that repeat the last change start the next run.
+struct QoiOps_s {
+	uint8_t lead;		// pixels that continue the previous run, 4 if all
+	uint8_t len;
+	uint8_t trail;
+	uint8_t last;
+	uint8_t ops[4];
+};
+
+static struct QoiOps_s qoiOps[4][256];
+static pthread_once_t qoiOnce = PTHREAD_ONCE_INIT;
+
+static inline uint8_t qoiHash(int v)
+{
+	return (v * 0x55 * 15 + 255 * 11) & 63;
+}
+
+static void buildQoiOps(void)
+{
+	for (int prev = 0; prev < 4; ++prev)
+		for (int b = 0; b < 256; ++b) {
+			struct QoiOps_s *t = &qoiOps[prev][b];
+			int last = prev, run = 0;
+			bool changed = false;
+
+			for (int i = 0; i < 4; ++i) {
+				int v = (b >> (6 - 2 * i)) & 3;
+				if (v == last) {
+					run++;
+					continue;
+				}
+				if (!changed)
+					t->lead = run;
+				else if (run)
+					t->ops[t->len++] = 0xc0 | (run - 1);
+				t->ops[t->len++] = qoiHash(v);
+				changed = true;
+				last = v;
+				run = 0;
+			}
+			if (!changed)
+				t->lead = 4;
+			t->trail = run;
+			t->last = last;
+		}
+}
+
+// QOI, as RGB. Every pixel is one of four grays, so a pixel is its 2-bit
+// value here and the ops are worked out from that; the file is the same as
+// one from the reference encoder. Once all four grays are in the index,
+// every pixel is either part of a run or an index op, and from there the
+// image is encoded a byte at a time from a table.
+static bool encodeQoi(struct ImageEncoder_s *e, const uint8_t *pixels, int width, int height, int stride)
+{
+	static const uint8_t end[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+	int index[64];
+	uint8_t *p = reserve(e, 14 + (size_t)width * height * 4 + sizeof(end));
+	uint8_t *o = p;
+	int prev = 0, run = 0, seen = 0;
+
+	pthread_once(&qoiOnce, buildQoiOps);
+	memcpy(o, "qoif", 4);
+	put32be(o + 4, width);
+	put32be(o + 8, height);
+	o[12] = 3;	// RGB
+	o[13] = 0;	// sRGB
+	o += 14;
+	memset(index, -1, sizeof(index));
+
+	for (int y = 0; y < height; ++y) {
+		const uint8_t *row = pixels + y * stride;
+		for (int x = 0; x < width; ) {
+			int v;
+			int8_t d;
+
+			if (seen == 15 && !(x & 3)) {
+				const struct QoiOps_s *t = &qoiOps[prev][row[x / 4]];
+				x += 4;
+				run += t->lead;
+				if (run >= 62) {
+					*o++ = 0xc0 | 61;
+					run -= 62;
+				}
+				if (t->lead == 4)
+					continue;
+				if (run)
+					*o++ = 0xc0 | (run - 1);
+				memcpy(o, t->ops, 4);
+				o += t->len;
+				run = t->trail;
+				prev = t->last;
+				continue;
+			}
+
+			v = (row[x / 4] >> (6 - 2 * (x & 3))) & 3;
+			++x;
+			if (v == prev) {
+				if (++run == 62) {
+					*o++ = 0xc0 | 61;
+					run = 0;
+				}
+				continue;
+			}
+			if (run) {
+				*o++ = 0xc0 | (run - 1);
+				run = 0;
+			}
+			if (index[qoiHash(v)] == v) {
+				*o++ = qoiHash(v);
+			} else {
+				index[qoiHash(v)] = v;
+				seen |= 1 << v;
+				// Grays are 0x55 apart, so only black and white, which
+				// wrap around to one apart, are ever close enough.
+				d = (v - prev) * 0x55;
+				if (d >= -2 && d <= 1) {
+					*o++ = 0x40 | (d + 2) << 4 | (d + 2) << 2 | (d + 2);
+				} else {
+					*o++ = 0xfe;
+					*o++ = v * 0x55;
+					*o++ = v * 0x55;
+					*o++ = v * 0x55;
+				}
+			}
+			prev = v;
+		}
+	}
+	if (run)
+		*o++ = 0xc0 | (run - 1);
+	memcpy(o, end, sizeof(end));
+	o += sizeof(end);
+	e->out = p;
+	e->outLen = o - p;
+	return true;
+}
+
+bool ImageEncoder_Encode(struct ImageEncoder_s *e, const uint8_t *pixels, int width, int height, int stride)
+{
+	return formats[e->format].encode(e, pixels, width, height, stride);
+}
+
+void ImageEncoder_Free(struct ImageEncoder_s *e)
+{
+	PngEncoder_Free(&e->png);
+	free(e->_buf);
+	memset(e, 0, sizeof(*e));
+}
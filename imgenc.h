@@ -0,0 +1,41 @@
+#ifndef _IMGENC_H_
+#define _IMGENC_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "pngenc.h"
+
+enum ImageFormat_e {
+	IMAGE_FORMAT_PNG,	// the default
+	IMAGE_FORMAT_RAW2,	// the 2-bit pixels as they are, no header
+	IMAGE_FORMAT_RAW8,	// one byte per pixel, no header
+	IMAGE_FORMAT_PGM,
+	IMAGE_FORMAT_QOI,
+	NUM_IMAGE_FORMATS
+};
+
+// Writes a decoded 2-bit grayscale image (four pixels per byte, leftmost
+// in the high bits, 0 is black) in one of the formats. PNG goes through
+// the PNG encoder, whose settings are set in png after ImageEncoder_Init.
+// The others do no compression, or only QOI's, so they are limited by
+// memory bandwidth rather than by deflate. As with the PNG encoder, the
+// output buffer is reused from one image to the next. One encoder per
+// thread.
+struct ImageEncoder_s {
+	enum ImageFormat_e format;
+	struct PngEncoder_s png;
+	const uint8_t *out;	// may point into the pixels that were passed in
+	size_t outLen;
+	uint8_t *_buf;
+	size_t _bufCap;
+};
+
+bool ImageEncoder_ParseFormat(const char *name, enum ImageFormat_e *format);
+const char *ImageEncoder_Extension(enum ImageFormat_e format);
+void ImageEncoder_Init(struct ImageEncoder_s *e, enum ImageFormat_e format);
+bool ImageEncoder_Encode(struct ImageEncoder_s *e, const uint8_t *pixels, int width, int height, int stride);
+void ImageEncoder_Free(struct ImageEncoder_s *e);
+
+/* _IMGENC_H_ */
+#endif
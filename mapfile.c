@@ -181,7 +181,7 @@ struct MappedFile_s MappedFile_Create(char *filename, size_t size)
 	struct MappedFile_s m;
 
 	m._fd = open(filename, O_RDWR | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR);
-	if (!m._fd) goto out_error;
+	if (m._fd == -1) goto out_error;
 	close(m._fd);
 	if (truncate(filename, size) < 0) goto out_error;
 	m._fd = open(filename, O_RDWR);
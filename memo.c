@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2013-2020 jkbenaim et al.
+ *
+ * This program is free software; you may redistribute and/or modify it under
+ * the terms of the expat license (also known as the "MIT license").
+ *
+ * This program is distributed in the hope that it will be useful, but without
+ * any warranty; without even the implied warranty of merchantability or
+ * firness for a particular purpose.
+ *
+ * For the full license text, see LICENSE.
+ *
+ ******************************************************************************
+ *
+ * This file implements the encode memo: images that were already encoded,
+ * looked up by what they were made from.
+ *
+ */
+
+#include "err_shim.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "memo.h"
+
+// An entry and its bytes, in one allocation: the input, then the output.
+struct MemoEntry_s {
+	uint64_t key;
+	int tag;
+	size_t inputLen;
+	size_t outLen;
+	uint8_t data[];
+};
+
+// Blank slots are all one byte over and over. Those are told apart by the
+// byte alone, so they skip the hash. That is all that is special about
+// them: the first blank image of each kind is encoded like any other, and
+// the rest are found in the table. Encoding them up front instead would
+// mean every frame in every color, for every run, most of which never
+// show up.
+static uint64_t memoKey(const uint8_t *input, size_t inputLen, int tag)
+{
+	if (inputLen && !memcmp(input, input + 1, inputLen - 1))
+		return hashMix(((uint64_t)(unsigned)tag << 32) ^ (inputLen << 8) ^ input[0]);
+	return hash64(input, inputLen, (uint64_t)(unsigned)tag);
+}
+
+void EncodeMemo_Init(struct EncodeMemo_s *m, size_t maxBytes)
+{
+	memset(m, 0, sizeof(*m));
+	m->maxBytes = maxBytes;
+	pthread_mutex_init(&m->_lock, NULL);
+}
+
+// Open addressing; _cap is a power of two, kept at most half full.
+static struct MemoEntry_s **findSlot(struct MemoEntry_s **table, size_t cap, uint64_t key,
+	const uint8_t *input, size_t inputLen, int tag)
+{
+	for (size_t i = key & (cap - 1); ; i = (i + 1) & (cap - 1)) {
+		struct MemoEntry_s *e = table[i];
+		if (!e || (e->key == key && e->tag == tag && e->inputLen == inputLen
+		 && !memcmp(e->data, input, inputLen)))
+			return &table[i];
+	}
+}
+
+// The bytes handed back stay valid until the memo is freed.
+bool EncodeMemo_Get(struct EncodeMemo_s *m, const uint8_t *input, size_t inputLen, int tag,
+	const uint8_t **out, size_t *outLen)
+{
+	uint64_t key = memoKey(input, inputLen, tag);
+	struct MemoEntry_s *e = NULL;
+
+	pthread_mutex_lock(&m->_lock);
+	if (m->_count)
+		e = *findSlot(m->_table, m->_cap, key, input, inputLen, tag);
+	pthread_mutex_unlock(&m->_lock);
+	if (!e)
+		return false;
+	*out = e->data + e->inputLen;
+	*outLen = e->outLen;
+	return true;
+}
+
+static void grow(struct EncodeMemo_s *m)
+{
+	size_t cap = m->_cap ? m->_cap * 2 : 256;
+	struct MemoEntry_s **table = calloc(cap, sizeof(*table));
+
+	if (!table) err(1, "malloc failure");
+	for (size_t i = 0; i < m->_cap; ++i) {
+		struct MemoEntry_s *e = m->_table[i];
+		if (e)
+			*findSlot(table, cap, e->key, e->data, e->inputLen, e->tag) = e;
+	}
+	free(m->_table);
+	m->_table = table;
+	m->_cap = cap;
+}
+
+// Two workers may encode the same image at once; the second Put is a no-op.
+void EncodeMemo_Put(struct EncodeMemo_s *m, const uint8_t *input, size_t inputLen, int tag,
+	const uint8_t *out, size_t outLen)
+{
+	uint64_t key = memoKey(input, inputLen, tag);
+	size_t size = sizeof(struct MemoEntry_s) + inputLen + outLen;
+	struct MemoEntry_s **slot, *e;
+
+	pthread_mutex_lock(&m->_lock);
+	if (m->_bytes + size > m->maxBytes) {
+		pthread_mutex_unlock(&m->_lock);
+		return;
+	}
+	if ((m->_count + 1) * 2 > m->_cap)
+		grow(m);
+	slot = findSlot(m->_table, m->_cap, key, input, inputLen, tag);
+	if (!*slot) {
+		e = malloc(size);
+		if (!e) err(1, "malloc failure");
+		e->key = key;
+		e->tag = tag;
+		e->inputLen = inputLen;
+		e->outLen = outLen;
+		memcpy(e->data, input, inputLen);
+		memcpy(e->data + inputLen, out, outLen);
+		*slot = e;
+		m->_count++;
+		m->_bytes += size;
+	}
+	pthread_mutex_unlock(&m->_lock);
+}
+
+void EncodeMemo_Free(struct EncodeMemo_s *m)
+{
+	for (size_t i = 0; i < m->_cap; ++i)
+		free(m->_table[i]);
+	free(m->_table);
+	pthread_mutex_destroy(&m->_lock);
+	memset(m, 0, sizeof(*m));
+}
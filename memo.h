@@ -0,0 +1,35 @@
+#ifndef _MEMO_H_
+#define _MEMO_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MEMO_DEFAULT_MAX_BYTES (64 * 1024 * 1024)
+
+struct MemoEntry_s;
+
+// Encoded images, keyed by the slot bytes they were decoded from and a tag
+// for everything else that went into them (the frame, or which crop). One
+// memo is shared by all the workers of a run, so a blank or copied photo
+// is only encoded once per batch. Entries stay until the memo is freed;
+// once maxBytes are held, new images are no longer added.
+struct EncodeMemo_s {
+	size_t maxBytes;
+	pthread_mutex_t _lock;
+	struct MemoEntry_s **_table;
+	size_t _cap;
+	size_t _count;
+	size_t _bytes;
+};
+
+void EncodeMemo_Init(struct EncodeMemo_s *m, size_t maxBytes);
+bool EncodeMemo_Get(struct EncodeMemo_s *m, const uint8_t *input, size_t inputLen, int tag,
+	const uint8_t **out, size_t *outLen);
+void EncodeMemo_Put(struct EncodeMemo_s *m, const uint8_t *input, size_t inputLen, int tag,
+	const uint8_t *out, size_t outLen);
+void EncodeMemo_Free(struct EncodeMemo_s *m);
+
+/* _MEMO_H_ */
+#endif
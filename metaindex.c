@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2013-2020 jkbenaim et al.
+ *
+ * This program is free software; you may redistribute and/or modify it under
+ * the terms of the expat license (also known as the "MIT license").
+ *
+ * This program is distributed in the hope that it will be useful, but without
+ * any warranty; without even the implied warranty of merchantability or
+ * firness for a particular purpose.
+ *
+ * For the full license text, see LICENSE.
+ *
+ ******************************************************************************
+ *
+ * This file implements the metadata index, in NDJSON or binary. The binary
+ * index is little-endian:
+ *
+ *   "GBCI", u16 version, u16 slot record size	once, at the start
+ *   u16 path length, path				then, for each save,
+ *   30 slot records					one per slot, in slot order
+ *
+ * A slot record is:
+ *
+ *   u8 slot, u8 picture (0 = deleted), u8 frame, u8 flags
+ *   (1 = copied, 2 = user magic, 4 = owner magic), u8 comment[27],
+ *   u8 checksum[2], then the user and the owner, each u8 user id[4],
+ *   u8 username[9], u8 blood/sex, u8 birthdate[4]
+ *
+ */
+
+#include "err_shim.h"
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gbcam.h"
+#include "metaindex.h"
+
+#define METAINDEX_VERSION 1
+#define SLOT_RECORD_SIZE (4 + 27 + 2 + 2 * 18)
+
+bool MetaIndex_ParseFormat(const char *name, enum MetaIndexFormat_e *format)
+{
+	if (!strcmp(name, "ndjson"))
+		*format = METAINDEX_NDJSON;
+	else if (!strcmp(name, "binary"))
+		*format = METAINDEX_BINARY;
+	else
+		return false;
+	return true;
+}
+
+void MetaIndex_Init(struct MetaIndex_s *x, enum MetaIndexFormat_e format)
+{
+	memset(x, 0, sizeof(*x));
+	x->format = format;
+}
+
+static char *reserve(struct MetaIndex_s *x, size_t len)
+{
+	if (x->len + len > x->_cap) {
+		size_t cap = (x->len + len) * 2;
+		char *p = realloc(x->buf, cap);
+		if (!p) err(1, "malloc failure");
+		x->buf = p;
+		x->_cap = cap;
+	}
+	return x->buf + x->len;
+}
+
+static void add(struct MetaIndex_s *x, const void *data, size_t len)
+{
+	memcpy(reserve(x, len), data, len);
+	x->len += len;
+}
+
+static void addf(struct MetaIndex_s *x, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(reserve(x, 256), 256, fmt, ap);
+	va_end(ap);
+	x->len += n < 256 ? n : 255;
+}
+
+static void addHex(struct MetaIndex_s *x, const uint8_t *data, size_t len)
+{
+	static const char digits[] = "0123456789abcdef";
+	char *p = reserve(x, len * 2 + 2);
+
+	*p++ = '"';
+	for (size_t i = 0; i < len; ++i) {
+		*p++ = digits[data[i] >> 4];
+		*p++ = digits[data[i] & 15];
+	}
+	*p++ = '"';
+	x->len += len * 2 + 2;
+}
+
+// The length of the UTF-8 sequence at s, or 0 if it isn't a valid one:
+// overlong forms, surrogates and anything past U+10FFFF are not.
+static int utf8Length(const unsigned char *s)
+{
+	int len;
+	unsigned min, c;
+
+	if (s[0] < 0x80)
+		return 1;
+	else if (s[0] >= 0xc2 && s[0] < 0xe0)
+		len = 2, min = 0x80, c = s[0] & 0x1f;
+	else if (s[0] >= 0xe0 && s[0] < 0xf0)
+		len = 3, min = 0x800, c = s[0] & 0x0f;
+	else if (s[0] >= 0xf0 && s[0] < 0xf5)
+		len = 4, min = 0x10000, c = s[0] & 0x07;
+	else
+		return 0;
+	for (int i = 1; i < len; ++i) {
+		if ((s[i] & 0xc0) != 0x80)
+			return 0;
+		c = c << 6 | (s[i] & 0x3f);
+	}
+	if (c < min || c > 0x10ffff || (c >= 0xd800 && c < 0xe000))
+		return 0;
+	return len;
+}
+
+// Paths are bytes, and JSON is UTF-8. Bytes that aren't part of a valid
+// UTF-8 sequence are escaped one by one as the code point of the same
+// value, so a Latin-1 name comes out as the characters it meant.
+static void addJsonString(struct MetaIndex_s *x, const char *s)
+{
+	const unsigned char *p = (const unsigned char *)s;
+	int len;
+
+	add(x, "\"", 1);
+	while (*p) {
+		if (*p == '"' || *p == '\\') {
+			addf(x, "\\%c", *p);
+			len = 1;
+		} else if (*p < 0x20 || !(len = utf8Length(p))) {
+			addf(x, "\\u%04x", *p);
+			len = 1;
+		} else {
+			add(x, p, len);
+		}
+		p += len;
+	}
+	add(x, "\"", 1);
+}
+
+static void addJsonUser(struct MetaIndex_s *x, const struct GbCam_User_s *u)
+{
+	addf(x, "{\"user_id\":");
+	addHex(x, u->userId, sizeof(u->userId));
+	addf(x, ",\"username\":");
+	addHex(x, u->username, sizeof(u->username));
+	addf(x, ",\"blood_sex\":%d,\"birthdate\":", u->bloodSex);
+	addHex(x, u->birthdate, sizeof(u->birthdate));
+	addf(x, ",\"magic\":%s}", u->magic ? "true" : "false");
+}
+
+static void addBinaryUser(struct MetaIndex_s *x, const struct GbCam_User_s *u)
+{
+	add(x, u->userId, sizeof(u->userId));
+	add(x, u->username, sizeof(u->username));
+	add(x, &u->bloodSex, 1);
+	add(x, u->birthdate, sizeof(u->birthdate));
+}
+
+void MetaIndex_AddHeader(struct MetaIndex_s *x)
+{
+	uint8_t h[8] = {'G', 'B', 'C', 'I', METAINDEX_VERSION, 0, SLOT_RECORD_SIZE, 0};
+
+	if (x->format == METAINDEX_BINARY)
+		add(x, h, sizeof(h));
+}
+
+void MetaIndex_AddSave(struct MetaIndex_s *x, const char *path, const struct GbCam_Save_s *save)
+{
+	struct GbCam_Metadata_s m;
+	size_t pathLen = strlen(path);
+
+	if (x->format == METAINDEX_BINARY) {
+		uint8_t len[2];
+		if (pathLen > 0xffff)
+			pathLen = 0xffff;
+		len[0] = pathLen;
+		len[1] = pathLen >> 8;
+		add(x, len, 2);
+		add(x, path, pathLen);
+	}
+
+	for (int slotNum = 1; slotNum <= GBCAM_NUM_SLOTS; ++slotNum) {
+		GbCam_SlotMetadata(save, slotNum, &m);
+		if (x->format == METAINDEX_BINARY) {
+			uint8_t head[4] = {m.slot, m.picture, m.frame,
+				m.copied | m.user.magic << 1 | m.owner.magic << 2};
+			add(x, head, 4);
+			add(x, m.comment, sizeof(m.comment));
+			add(x, m.checksum, sizeof(m.checksum));
+			addBinaryUser(x, &m.user);
+			addBinaryUser(x, &m.owner);
+			continue;
+		}
+		addf(x, "{\"save\":");
+		addJsonString(x, path);
+		addf(x, ",\"slot\":%d,\"picture\":%d,\"deleted\":%s,\"frame\":%d,\"copied\":%s,\"comment\":",
+			m.slot, m.picture, m.picture ? "false" : "true", m.frame, m.copied ? "true" : "false");
+		addHex(x, m.comment, sizeof(m.comment));
+		addf(x, ",\"checksum\":");
+		addHex(x, m.checksum, sizeof(m.checksum));
+		addf(x, ",\"user\":");
+		addJsonUser(x, &m.user);
+		addf(x, ",\"owner\":");
+		addJsonUser(x, &m.owner);
+		addf(x, "}\n");
+	}
+}
+
+void MetaIndex_Free(struct MetaIndex_s *x)
+{
+	free(x->buf);
+	x->buf = NULL;
+}
@@ -0,0 +1,30 @@
+#ifndef _METAINDEX_H_
+#define _METAINDEX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "gbcam.h"
+
+enum MetaIndexFormat_e {
+	METAINDEX_NONE,
+	METAINDEX_NDJSON,	// one JSON object per slot, per line
+	METAINDEX_BINARY,	// fixed-size records, see metaindex.c
+};
+
+// Records for one or more saves, built up in a buffer that is reused.
+struct MetaIndex_s {
+	enum MetaIndexFormat_e format;
+	char *buf;
+	size_t len;
+	size_t _cap;
+};
+
+bool MetaIndex_ParseFormat(const char *name, enum MetaIndexFormat_e *format);
+void MetaIndex_Init(struct MetaIndex_s *x, enum MetaIndexFormat_e format);
+void MetaIndex_AddHeader(struct MetaIndex_s *x);
+void MetaIndex_AddSave(struct MetaIndex_s *x, const char *path, const struct GbCam_Save_s *save);
+void MetaIndex_Free(struct MetaIndex_s *x);
+
+/* _METAINDEX_H_ */
+#endif
@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2013-2020 jkbenaim et al.
+ *
+ * This program is free software; you may redistribute and/or modify it under
+ * the terms of the expat license (also known as the "MIT license").
+ *
+ * This program is distributed in the hope that it will be useful, but without
+ * any warranty; without even the implied warranty of merchantability or
+ * firness for a particular purpose.
+ *
+ * For the full license text, see LICENSE.
+ *
+ ******************************************************************************
+ *
+ * This file implements the outputs: plain files, or a tar or zip archive
+ * streamed to a file descriptor.
+ *
+ */
+
+#include "err_shim.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "output.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define MANIFEST_NAME "manifest.txt"
+
+struct ZipEntry_s {
+	size_t path;		// offset into _names
+	uint32_t crc;
+	uint32_t size;
+	uint32_t offset;
+};
+
+static const struct {
+	const char *name;
+	enum OutputKind_e kind;
+} kinds[] = {
+	{"files", OUTPUT_FILES},
+	{"tar", OUTPUT_TAR},
+	{"zip", OUTPUT_ZIP},
+};
+
+bool Output_ParseKind(const char *name, enum OutputKind_e *kind)
+{
+	for (size_t i = 0; i < sizeof(kinds)/sizeof(kinds[0]); ++i)
+		if (!strcmp(kinds[i].name, name)) {
+			*kind = kinds[i].kind;
+			return true;
+		}
+	return false;
+}
+
+static bool writeAll(int fd, const void *buf, size_t len)
+{
+	const uint8_t *data = buf;
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, data, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+// Plain open/write rather than stdio, which would allocate a FILE and its
+// buffer for every image.
+static bool writeFile(const char *filename, const uint8_t *data, size_t len)
+{
+	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+
+	if (fd == -1) {
+		warn("couldn't open '%s' for writing", filename);
+		return false;
+	}
+	if (!writeAll(fd, data, len)) {
+		warn("couldn't write '%s'", filename);
+		close(fd);
+		return false;
+	}
+	if (close(fd)) {
+		warn("couldn't write '%s'", filename);
+		return false;
+	}
+	return true;
+}
+
+static inline void put16le(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static inline void put32le(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static bool emit(struct Output_s *o, const void *buf, size_t len)
+{
+	if (!writeAll(o->fd, buf, len))
+		return false;
+	o->_offset += len;
+	return true;
+}
+
+static bool tarWrite(struct Output_s *o, const char *path, const uint8_t *data, size_t len)
+{
+	static const uint8_t zeros[512];
+	uint8_t h[512] = {0};
+	size_t pathLen = strlen(path);
+	const char *name = path;
+	unsigned int sum = 0;
+
+	// Names longer than 100 bytes are split at a slash into prefix and name.
+	if (pathLen > 100) {
+		const char *slash = strchr(path + pathLen - 101, '/');
+		if (!slash || slash - path > 155) {
+			warnx("'%s': path too long for tar", path);
+			return false;
+		}
+		memcpy(h + 345, path, slash - path);
+		name = slash + 1;
+	}
+	memcpy(h, name, strlen(name));
+	memcpy(h + 100, "0000644", 7);
+	memcpy(h + 108, "0000000", 7);
+	memcpy(h + 116, "0000000", 7);
+	snprintf((char *)h + 124, 12, "%011" PRIo64, (uint64_t)len);
+	snprintf((char *)h + 136, 12, "%011" PRIo32, o->_time);
+	memset(h + 148, ' ', 8);
+	h[156] = '0';
+	memcpy(h + 257, "ustar", 6);
+	memcpy(h + 263, "00", 2);
+	for (int i = 0; i < 512; ++i)
+		sum += h[i];
+	snprintf((char *)h + 148, 8, "%06o", sum);
+
+	return emit(o, h, sizeof(h)) && emit(o, data, len)
+		&& emit(o, zeros, (512 - len % 512) % 512);
+}
+
+static uint32_t dosTime(time_t t)
+{
+	struct tm *tm = localtime(&t);
+	if (!tm || tm->tm_year < 80)
+		return (1 << 21) | (1 << 16);	// 1980-01-01
+	return ((tm->tm_year - 80) << 25) | ((tm->tm_mon + 1) << 21) | (tm->tm_mday << 16)
+		| (tm->tm_hour << 11) | (tm->tm_min << 5) | (tm->tm_sec / 2);
+}
+
+static bool zipWrite(struct Output_s *o, const char *path, const uint8_t *data, size_t len)
+{
+	uint8_t h[30];
+	size_t pathLen = strlen(path);
+	struct ZipEntry_s *e;
+
+	// There is no zip64 support, so stay inside the classic limits.
+	if (o->_numEntries >= 0xFFFF || o->_offset + len + 30 + pathLen > 0xFFFFFFFFu) {
+		warnx("'%s': zip archive too large", path);
+		return false;
+	}
+	if (o->_numEntries == o->_entriesCap) {
+		size_t cap = o->_entriesCap ? o->_entriesCap * 2 : 64;
+		e = realloc(o->_entries, cap * sizeof(*e));
+		if (!e) err(1, "malloc failure");
+		o->_entries = e;
+		o->_entriesCap = cap;
+	}
+	if (o->_namesLen + pathLen + 1 > o->_namesCap) {
+		size_t cap = (o->_namesLen + pathLen + 1) * 2;
+		char *p = realloc(o->_names, cap);
+		if (!p) err(1, "malloc failure");
+		o->_names = p;
+		o->_namesCap = cap;
+	}
+	e = &o->_entries[o->_numEntries++];
+	e->path = o->_namesLen;
+	memcpy(o->_names + o->_namesLen, path, pathLen + 1);
+	o->_namesLen += pathLen + 1;
+	e->crc = crc32(0, data, len);
+	e->size = len;
+	e->offset = o->_offset;
+
+	put32le(h, 0x04034b50);
+	put16le(h + 4, 10);		// version needed: 1.0
+	put16le(h + 6, 0);		// flags
+	put16le(h + 8, 0);		// method: stored
+	put32le(h + 10, o->_time);
+	put32le(h + 14, e->crc);
+	put32le(h + 18, len);
+	put32le(h + 22, len);
+	put16le(h + 26, pathLen);
+	put16le(h + 28, 0);
+	return emit(o, h, sizeof(h)) && emit(o, path, pathLen) && emit(o, data, len);
+}
+
+static bool zipFinish(struct Output_s *o)
+{
+	uint8_t h[46];
+	uint64_t start = o->_offset;
+
+	for (size_t i = 0; i < o->_numEntries; ++i) {
+		const struct ZipEntry_s *e = &o->_entries[i];
+		const char *path = o->_names + e->path;
+		size_t pathLen = strlen(path);
+		put32le(h, 0x02014b50);
+		put16le(h + 4, 0x031e);		// made by: unix, 3.0
+		put16le(h + 6, 10);
+		put16le(h + 8, 0);
+		put16le(h + 10, 0);
+		put32le(h + 12, o->_time);
+		put32le(h + 16, e->crc);
+		put32le(h + 20, e->size);
+		put32le(h + 24, e->size);
+		put16le(h + 28, pathLen);
+		put16le(h + 30, 0);		// extra field length
+		put16le(h + 32, 0);		// comment length
+		put16le(h + 34, 0);		// disk number
+		put16le(h + 36, 0);		// internal attributes
+		put32le(h + 38, 0100644u << 16);	// external attributes
+		put32le(h + 42, e->offset);
+		if (!emit(o, h, 46) || !emit(o, path, pathLen))
+			return false;
+	}
+	if (o->_offset > 0xFFFFFFFFu) {
+		warnx("zip archive too large");
+		return false;
+	}
+
+	put32le(h, 0x06054b50);
+	put16le(h + 4, 0);
+	put16le(h + 6, 0);
+	put16le(h + 8, o->_numEntries);
+	put16le(h + 10, o->_numEntries);
+	put32le(h + 12, o->_offset - start);
+	put32le(h + 16, start);
+	put16le(h + 20, 0);
+	return emit(o, h, 22);
+}
+
+void Output_Open(struct Output_s *o, enum OutputKind_e kind, int fd)
+{
+	memset(o, 0, sizeof(*o));
+	pthread_mutex_init(&o->_lock, NULL);
+	o->kind = kind;
+	o->fd = fd;
+	if (kind == OUTPUT_TAR)
+		o->_time = time(NULL);
+	else if (kind == OUTPUT_ZIP)
+		o->_time = dosTime(time(NULL));
+#ifdef __MINGW32__
+	if (kind != OUTPUT_FILES)
+		setmode(fd, O_BINARY);
+#endif
+}
+
+// Files are written whole, in the order they are finished. In an archive
+// each file is also listed in the manifest: path, size and crc32.
+bool Output_Write(struct Output_s *o, const char *path, const uint8_t *data, size_t len)
+{
+	bool ok;
+	size_t need;
+
+	if (o->kind == OUTPUT_FILES)
+		return writeFile(path, data, len);
+
+	pthread_mutex_lock(&o->_lock);
+	if (o->_failed) {
+		pthread_mutex_unlock(&o->_lock);
+		return false;
+	}
+	errno = 0;
+	if (o->kind == OUTPUT_TAR)
+		ok = tarWrite(o, path, data, len);
+	else
+		ok = zipWrite(o, path, data, len);
+	if (!ok) {
+		if (errno)
+			warn("couldn't write archive");
+		o->_failed = true;
+		pthread_mutex_unlock(&o->_lock);
+		return false;
+	}
+
+	need = o->_manifestLen + strlen(path) + 32;
+	if (need > o->_manifestCap) {
+		char *p = realloc(o->_manifest, need * 2);
+		if (!p) err(1, "malloc failure");
+		o->_manifest = p;
+		o->_manifestCap = need * 2;
+	}
+	o->_manifestLen += sprintf(o->_manifest + o->_manifestLen, "%s\t%zu\t%08lx\n",
+		path, len, (unsigned long)crc32(0, data, len));
+	pthread_mutex_unlock(&o->_lock);
+	return true;
+}
+
+// Bytes straight to fd, for outputs that are one stream rather than files.
+// Each call's bytes are written together.
+bool Output_WriteStream(struct Output_s *o, const void *data, size_t len)
+{
+	bool ok;
+
+	pthread_mutex_lock(&o->_lock);
+	ok = !o->_failed && writeAll(o->fd, data, len);
+	if (!ok && !o->_failed) {
+		warn("couldn't write output");
+		o->_failed = true;
+	}
+	pthread_mutex_unlock(&o->_lock);
+	return ok;
+}
+
+bool Output_Close(struct Output_s *o)
+{
+	bool ok = !o->_failed;
+
+	if (ok && o->kind != OUTPUT_FILES) {
+		errno = 0;
+		if (o->kind == OUTPUT_TAR) {
+			static const uint8_t zeros[1024];
+			ok = tarWrite(o, MANIFEST_NAME, (uint8_t *)o->_manifest, o->_manifestLen)
+				&& emit(o, zeros, sizeof(zeros));
+		} else {
+			ok = zipWrite(o, MANIFEST_NAME, (uint8_t *)o->_manifest, o->_manifestLen)
+				&& zipFinish(o);
+		}
+		if (!ok && errno)
+			warn("couldn't write archive");
+	}
+
+	free(o->_entries);
+	free(o->_names);
+	free(o->_manifest);
+	pthread_mutex_destroy(&o->_lock);
+	return ok;
+}
@@ -0,0 +1,45 @@
+#ifndef _OUTPUT_H_
+#define _OUTPUT_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum OutputKind_e {
+	OUTPUT_FILES,	// plain files in the filesystem
+	OUTPUT_TAR,	// a ustar stream on a file descriptor
+	OUTPUT_ZIP,	// an uncompressed zip stream on a file descriptor
+};
+
+struct ZipEntry_s;
+
+// Where finished files go. Archive outputs stream each file as soon as it
+// is written and finish with a manifest; they never seek, so they can be
+// written to a pipe. Safe to use from several threads.
+struct Output_s {
+	enum OutputKind_e kind;
+	int fd;
+	pthread_mutex_t _lock;
+	uint64_t _offset;
+	uint32_t _time;
+	struct ZipEntry_s *_entries;
+	size_t _numEntries;
+	size_t _entriesCap;
+	char *_names;
+	size_t _namesLen;
+	size_t _namesCap;
+	char *_manifest;
+	size_t _manifestLen;
+	size_t _manifestCap;
+	bool _failed;
+};
+
+bool Output_ParseKind(const char *name, enum OutputKind_e *kind);
+void Output_Open(struct Output_s *o, enum OutputKind_e kind, int fd);
+bool Output_Write(struct Output_s *o, const char *path, const uint8_t *data, size_t len);
+bool Output_WriteStream(struct Output_s *o, const void *data, size_t len);
+bool Output_Close(struct Output_s *o);
+
+/* _OUTPUT_H_ */
+#endif
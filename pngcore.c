@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2013-2020 jkbenaim et al.
+ *
+ * This program is free software; you may redistribute and/or modify it under
+ * the terms of the expat license (also known as the "MIT license").
+ *
+ * This program is distributed in the hope that it will be useful, but without
+ * any warranty; without even the implied warranty of merchantability or
+ * firness for a particular purpose.
+ *
+ * For the full license text, see LICENSE.
+ *
+ ******************************************************************************
+ *
+ * This file implements the allocation-free part of the PNG writer: row
+ * filters, the chunks around the IDAT, and the static encoder libgbcam
+ * uses. It needs nothing but zlib, so the library doesn't pull in libpng.
+ *
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "pngcore.h"
+
+const uint8_t pngSignature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+// Everything after IDAT is the same for every image, so it is built once.
+static uint8_t pngTail[128];
+static size_t pngTailLen;
+static pthread_once_t pngTailOnce = PTHREAD_ONCE_INIT;
+
+static inline void put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+// Write a chunk around data that is already in place at p + 8. The crc is
+// computed right after the data was written, while it is still in cache.
+size_t finishChunk(uint8_t *p, const char type[4], size_t len)
+{
+	put32(p, len);
+	memcpy(p + 4, type, 4);
+	put32(p + 8 + len, crc32(0, p + 4, len + 4));
+	return len + 12;
+}
+
+static size_t textChunk(uint8_t *p, const char *key, const char *text)
+{
+	size_t keyLen = strlen(key) + 1, textLen = strlen(text);
+	memcpy(p + 8, key, keyLen);
+	memcpy(p + 8 + keyLen, text, textLen);
+	return finishChunk(p, "tEXt", keyLen + textLen);
+}
+
+static void buildTail(void)
+{
+	uint8_t *p = pngTail;
+	p += textChunk(p, "Source", "Nintendo Gameboy Camera");
+	p += textChunk(p, "Software", "gbcamextract");
+	p += finishChunk(p, "IEND", 0);
+	pngTailLen = p - pngTail;
+}
+
+static inline uint8_t paeth(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	if (pa <= pb && pa <= pc)
+		return a;
+	return (pb <= pc) ? b : c;
+}
+
+// Filter one row. For bit depths below 8 the filters work on whole bytes,
+// with the byte to the left as the previous "pixel".
+void filterRow(uint8_t *dst, const uint8_t *row, const uint8_t *prev, size_t n, int filter)
+{
+	size_t i;
+	dst[0] = filter;
+	dst++;
+	for (i = 0; i < n; ++i) {
+		int a = i ? row[i-1] : 0;
+		int b = prev ? prev[i] : 0;
+		int c = (i && prev) ? prev[i-1] : 0;
+		switch (filter) {
+		case 0: dst[i] = row[i]; break;
+		case 1: dst[i] = row[i] - a; break;
+		case 2: dst[i] = row[i] - b; break;
+		case 3: dst[i] = row[i] - ((a + b) >> 1); break;
+		case 4: dst[i] = row[i] - paeth(a, b, c); break;
+		}
+	}
+}
+
+// Room for a whole file whose rawLen bytes of filtered rows go through z.
+size_t pngBound(z_stream *z, size_t rawLen)
+{
+	pthread_once(&pngTailOnce, buildTail);
+	return PNG_IHDR_END + 12 + deflateBound(z, rawLen) + pngTailLen;
+}
+
+// Write the whole file around an already filtered image. Returns its
+// length, or 0 if it doesn't fit in cap.
+size_t assemblePng(uint8_t *out, size_t cap, z_stream *z, const uint8_t *raw, size_t rawLen, int width, int height)
+{
+	uint8_t *p = out, *idat;
+	size_t room;
+
+	pthread_once(&pngTailOnce, buildTail);
+	if (cap < PNG_IHDR_END + 12 + pngTailLen)
+		return 0;
+	memcpy(p, pngSignature, sizeof(pngSignature));
+	p += sizeof(pngSignature);
+
+	put32(p + 8, width);
+	put32(p + 12, height);
+	p[16] = 2;	// bit depth
+	p[17] = 0;	// color type: grayscale
+	p[18] = 0;	// compression method
+	p[19] = 0;	// filter method
+	p[20] = 0;	// interlace method
+	p += finishChunk(p, "IHDR", 13);
+
+	idat = p + 8;
+	room = cap - (idat - out) - 4 - pngTailLen;
+	z->next_in = (uint8_t *)raw;
+	z->avail_in = rawLen;
+	z->next_out = idat;
+	z->avail_out = room > 0xFFFFFFFFu ? 0xFFFFFFFFu : room;
+	if (deflate(z, Z_FINISH) != Z_STREAM_END)
+		return 0;
+	p += finishChunk(p, "IDAT", z->total_out);
+
+	memcpy(p, pngTail, pngTailLen);
+	p += pngTailLen;
+	return p - out;
+}
+
+// Bump allocator for zlib over the caller's work area; nothing is freed
+// until the whole area is dropped.
+struct StaticWork_s {
+	uint8_t *p;
+	size_t left;
+};
+
+static voidpf staticAlloc(voidpf opaque, uInt items, uInt size)
+{
+	struct StaticWork_s *w = opaque;
+	size_t n = ((size_t)items * size + 15) & ~(size_t)15;
+	void *p;
+
+	if (n > w->left)
+		return Z_NULL;
+	p = w->p;
+	w->p += n;
+	w->left -= n;
+	return p;
+}
+
+static void staticFree(voidpf opaque, voidpf address)
+{
+}
+
+// Encode with the balanced settings into caller-supplied memory, without
+// allocating anything. work holds the filtered rows and the deflate state.
+// Returns the PNG's length, or 0 if out or work is too small.
+size_t encodeStaticPng(const uint8_t *pixels, int width, int height, int stride,
+	uint8_t *out, size_t outCap, void *work, size_t workLen)
+{
+	size_t rowBytes = (width * 2 + 7) / 8;
+	size_t rawLen = (rowBytes + 1) * height;
+	struct StaticWork_s w;
+	z_stream z = {0};
+	uint8_t *raw = work;
+	size_t len;
+
+	rawLen = (rawLen + 15) & ~(size_t)15;
+	if (workLen < rawLen)
+		return 0;
+	for (int y = 0; y < height; ++y)
+		filterRow(raw + y * (rowBytes + 1), pixels + y * stride, NULL, rowBytes, 0);
+
+	w.p = raw + rawLen;
+	w.left = workLen - rawLen;
+	z.zalloc = staticAlloc;
+	z.zfree = staticFree;
+	z.opaque = &w;
+	if (deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, 15, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+		return 0;
+	len = assemblePng(out, outCap, &z, raw, (rowBytes + 1) * height, width, height);
+	deflateEnd(&z);
+	return len;
+}
@@ -0,0 +1,25 @@
+#ifndef _PNGCORE_H_
+#define _PNGCORE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zlib.h>
+
+// The parts of the PNG writer that allocate nothing and need only zlib.
+// libgbcam is built from these; the encoder in pngenc.c adds buffers,
+// profiles and libpng on top.
+
+extern const uint8_t pngSignature[8];
+
+// Where the IHDR chunk ends, i.e. where the first chunk after it starts.
+#define PNG_IHDR_END (8 + 25)
+
+size_t finishChunk(uint8_t *p, const char type[4], size_t len);
+void filterRow(uint8_t *dst, const uint8_t *row, const uint8_t *prev, size_t n, int filter);
+size_t pngBound(z_stream *z, size_t rawLen);
+size_t assemblePng(uint8_t *out, size_t cap, z_stream *z, const uint8_t *raw, size_t rawLen, int width, int height);
+size_t encodeStaticPng(const uint8_t *pixels, int width, int height, int stride,
+	uint8_t *out, size_t outCap, void *work, size_t workLen);
+
+/* _PNGCORE_H_ */
+#endif
@@ -0,0 +1,407 @@
+/*
+ * Copyright (c) 2013-2020 jkbenaim et al.
+ *
+ * This program is free software; you may redistribute and/or modify it under
+ * the terms of the expat license (also known as the "MIT license").
+ *
+ * This program is distributed in the hope that it will be useful, but without
+ * any warranty; without even the implied warranty of merchantability or
+ * firness for a particular purpose.
+ *
+ * For the full license text, see LICENSE.
+ *
+ ******************************************************************************
+ *
+ * This file implements the PNG writers for 2-bit grayscale images, which is
+ * all this program ever writes. There is a small built-in one, on top of
+ * pngcore.c, and one that goes through libpng; both produce the same chunks
+ * (IHDR, IDAT, the two tEXt chunks, IEND) into the encoder's output buffer.
+ *
+ */
+
+#include "err_shim.h"
+#include <ctype.h>
+#include <errno.h>
+#include <png.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "pngcore.h"
+#include "pngenc.h"
+
+// Row filter 5 isn't a PNG filter type: it means picking one per row.
+#define FILTER_ADAPTIVE 5
+
+struct PngParams_s {
+	int level;
+	int strategy;
+	int filter;
+};
+
+static const struct PngParams_s balancedParams[] = {
+	{Z_BEST_COMPRESSION, Z_DEFAULT_STRATEGY, 0},
+};
+
+static const struct PngParams_s fastParams[] = {
+	{Z_BEST_SPEED, Z_DEFAULT_STRATEGY, 0},
+};
+
+static const struct PngParams_s smallestParams[] = {
+	{Z_BEST_COMPRESSION, Z_DEFAULT_STRATEGY, 0},
+	{Z_BEST_COMPRESSION, Z_FILTERED, 0},
+	{Z_BEST_COMPRESSION, Z_RLE, 0},
+	{Z_BEST_COMPRESSION, Z_DEFAULT_STRATEGY, 1},
+	{Z_BEST_COMPRESSION, Z_FILTERED, 1},
+	{Z_BEST_COMPRESSION, Z_RLE, 1},
+	{Z_BEST_COMPRESSION, Z_DEFAULT_STRATEGY, 2},
+	{Z_BEST_COMPRESSION, Z_FILTERED, 2},
+	{Z_BEST_COMPRESSION, Z_RLE, 2},
+	{Z_BEST_COMPRESSION, Z_DEFAULT_STRATEGY, 4},
+	{Z_BEST_COMPRESSION, Z_FILTERED, 4},
+	{Z_BEST_COMPRESSION, Z_RLE, 4},
+	{Z_BEST_COMPRESSION, Z_DEFAULT_STRATEGY, FILTER_ADAPTIVE},
+	{Z_BEST_COMPRESSION, Z_FILTERED, FILTER_ADAPTIVE},
+	{Z_BEST_COMPRESSION, Z_RLE, FILTER_ADAPTIVE},
+};
+
+static const struct {
+	const char *name;
+	const struct PngParams_s *params;
+	int numParams;
+} profiles[] = {
+	[PNG_PROFILE_BALANCED] = {"balanced", balancedParams, 1},
+	[PNG_PROFILE_FAST] = {"fast", fastParams, 1},
+	[PNG_PROFILE_SMALLEST] = {"smallest", smallestParams,
+		sizeof(smallestParams)/sizeof(smallestParams[0])},
+};
+
+static const struct PngPalette_s builtinPalettes[] = {
+	{"gray", {{0x00, 0x00, 0x00}, {0x55, 0x55, 0x55}, {0xaa, 0xaa, 0xaa}, {0xff, 0xff, 0xff}}},
+	{"dmg", {{0x0f, 0x38, 0x0f}, {0x30, 0x62, 0x30}, {0x8b, 0xac, 0x0f}, {0x9b, 0xbc, 0x0f}}},
+};
+
+static void reserve(uint8_t **buf, size_t *cap, size_t need)
+{
+	if (need <= *cap)
+		return;
+	free(*buf);
+	*buf = malloc(need);
+	if (!*buf) err(1, "malloc failure");
+	*cap = need;
+}
+
+void PngEncoder_Init(struct PngEncoder_s *e)
+{
+	memset(e, 0, sizeof(*e));
+}
+
+bool PngEncoder_ParseProfile(const char *name, enum PngProfile_e *profile)
+{
+	for (int i = 0; i < sizeof(profiles)/sizeof(profiles[0]); ++i)
+		if (!strcmp(profiles[i].name, name)) {
+			*profile = i;
+			return true;
+		}
+	return false;
+}
+
+// A built-in palette's name, or name=RRGGBB:RRGGBB:RRGGBB:RRGGBB with the
+// darkest color first. Names end up in file names, so they are kept to
+// letters, digits, '-' and '_'.
+bool PngEncoder_ParsePalette(const char *spec, struct PngPalette_s *palette)
+{
+	const char *eq = strchr(spec, '=');
+	size_t nameLen = eq ? (size_t)(eq - spec) : strlen(spec);
+	const char *p;
+
+	if (!nameLen || nameLen >= sizeof(palette->name))
+		return false;
+	for (size_t i = 0; i < nameLen; ++i)
+		if (!isalnum((unsigned char)spec[i]) && spec[i] != '-' && spec[i] != '_')
+			return false;
+	memset(palette, 0, sizeof(*palette));
+	memcpy(palette->name, spec, nameLen);
+
+	if (!eq) {
+		for (size_t i = 0; i < sizeof(builtinPalettes)/sizeof(builtinPalettes[0]); ++i)
+			if (!strcmp(builtinPalettes[i].name, palette->name)) {
+				*palette = builtinPalettes[i];
+				return true;
+			}
+		return false;
+	}
+
+	p = eq + 1;
+	for (int i = 0; i < 4; ++i) {
+		unsigned int r, g, b;
+		int n = 0;
+		if (sscanf(p, "%2x%2x%2x%n", &r, &g, &b, &n) != 3 || n != 6)
+			return false;
+		palette->rgb[i][0] = r;
+		palette->rgb[i][1] = g;
+		palette->rgb[i][2] = b;
+		p += 6;
+		if (*p != (i < 3 ? ':' : '\0'))
+			return false;
+		p++;
+	}
+	return true;
+}
+
+// Turn one of this encoder's grayscale PNGs into an indexed one. 2-bit
+// gray and 2-bit indexed pixels are the same bytes, so the IDAT and
+// everything after it is copied as it is; only the IHDR's color type
+// changes, and a PLTE chunk goes in after it. Returns the new length, or
+// 0 if png isn't one of ours or out is too small.
+size_t PngEncoder_Recolor(const uint8_t *png, size_t len, const struct PngPalette_s *palette,
+	uint8_t *out, size_t outCap)
+{
+	const size_t ihdrEnd = sizeof(pngSignature) + 25;
+	uint8_t *p = out + ihdrEnd;
+
+	if (len < ihdrEnd || outCap < len + PNG_PALETTE_CHUNK_SIZE
+	 || memcmp(png, pngSignature, sizeof(pngSignature)) || memcmp(png + 12, "IHDR", 4)
+	 || png[24] != 2 || png[25] != 0)
+		return 0;
+	memcpy(out, png, ihdrEnd);
+	out[25] = 3;	// color type: indexed
+	finishChunk(out + sizeof(pngSignature), "IHDR", 13);
+	memcpy(p + 8, palette->rgb, sizeof(palette->rgb));
+	p += finishChunk(p, "PLTE", sizeof(palette->rgb));
+	memcpy(p, png + ihdrEnd, len - ihdrEnd);
+	return len + PNG_PALETTE_CHUNK_SIZE;
+}
+
+// Pick the filter with the smallest sum of absolute values, the same
+// heuristic libpng uses.
+static void filterRowAdaptive(struct PngEncoder_s *e, uint8_t *dst, const uint8_t *row, const uint8_t *prev, size_t n)
+{
+	unsigned int best = ~0u, sum;
+	int bestFilter = 0;
+
+	reserve(&e->_scratch, &e->_scratchCap, n + 1);
+	for (int f = 0; f <= 4; ++f) {
+		filterRow(e->_scratch, row, prev, n, f);
+		sum = 0;
+		for (size_t i = 1; i <= n; ++i)
+			sum += abs((int8_t)e->_scratch[i]);
+		if (sum < best) {
+			best = sum;
+			bestFilter = f;
+		}
+	}
+	filterRow(dst, row, prev, n, bestFilter);
+}
+
+static bool encodeBuiltin(struct PngEncoder_s *e, const struct PngParams_s *params, const uint8_t *pixels, int width, int height, int stride)
+{
+	size_t rowBytes = (width * 2 + 7) / 8;
+	size_t rawLen = (rowBytes + 1) * height;
+	z_stream *z = &e->_z;
+
+	reserve(&e->_raw, &e->_rawCap, rawLen);
+	for (int y = 0; y < height; ++y) {
+		const uint8_t *prev = y ? pixels + (y-1) * stride : NULL;
+		uint8_t *dst = e->_raw + y * (rowBytes + 1);
+		if (params->filter == FILTER_ADAPTIVE)
+			filterRowAdaptive(e, dst, pixels + y * stride, prev, rowBytes);
+		else
+			filterRow(dst, pixels + y * stride, prev, rowBytes, params->filter);
+	}
+
+	// The deflate stream is set up once and reset for every image.
+	if (!e->_zReady) {
+		if (deflateInit2(z, params->level, Z_DEFLATED, 15, 9, params->strategy) != Z_OK)
+			return false;
+		e->_zReady = true;
+	} else if (deflateReset(z) != Z_OK
+	    || deflateParams(z, params->level, params->strategy) != Z_OK) {
+		return false;
+	}
+
+	reserve(&e->out, &e->_outCap, pngBound(z, rawLen));
+	e->outLen = assemblePng(e->out, e->_outCap, z, e->_raw, rawLen, width, height);
+	return e->outLen != 0;
+}
+
+// libpng allocates from a bump arena owned by the encoder. Whatever doesn't
+// fit goes to malloc, and the arena is grown to the high-water mark when it
+// is reset, so only the first image ever reaches malloc.
+static png_voidp arenaMalloc(png_structp png_ptr, png_alloc_size_t size)
+{
+	struct PngEncoder_s *e = png_get_mem_ptr(png_ptr);
+	uint8_t *p;
+
+	size = (size + 15) & ~(png_alloc_size_t)15;
+	e->_arenaNeed += size;
+	if (e->_arenaUsed + size <= e->_arenaCap) {
+		p = e->_arena + e->_arenaUsed;
+		e->_arenaUsed += size;
+		return p;
+	}
+	return malloc(size);
+}
+
+static void arenaFree(png_structp png_ptr, png_voidp ptr)
+{
+	struct PngEncoder_s *e = png_get_mem_ptr(png_ptr);
+	uint8_t *p = ptr;
+
+	if (p >= e->_arena && p < e->_arena + e->_arenaCap)
+		return;
+	free(ptr);
+}
+
+static void arenaReset(struct PngEncoder_s *e)
+{
+	if (e->_arenaNeed > e->_arenaCap) {
+		free(e->_arena);
+		e->_arena = malloc(e->_arenaNeed);
+		if (!e->_arena) err(1, "malloc failure");
+		e->_arenaCap = e->_arenaNeed;
+	}
+	e->_arenaUsed = 0;
+	e->_arenaNeed = 0;
+}
+
+static void bufferWrite(png_structp png_ptr, png_bytep data, png_size_t len)
+{
+	struct PngEncoder_s *e = png_get_io_ptr(png_ptr);
+	size_t need = e->outLen + len;
+
+	if (need > e->_outCap) {
+		uint8_t *p = realloc(e->out, need * 2);
+		if (!p) png_error(png_ptr, "malloc failure");
+		e->out = p;
+		e->_outCap = need * 2;
+	}
+	memcpy(e->out + e->outLen, data, len);
+	e->outLen += len;
+}
+
+static void bufferFlush(png_structp png_ptr)
+{
+}
+
+static bool encodeLibpng(struct PngEncoder_s *e, const struct PngParams_s *params, const uint8_t *pixels, int width, int height, int stride)
+{
+	png_structp png_ptr;
+	png_infop info_ptr = NULL;
+	bool ok = false;
+	int y;
+
+	if (e->_rowsCap < height) {
+		free(e->_rows);
+		e->_rows = malloc(sizeof(*e->_rows) * height);
+		if (!e->_rows) err(1, "malloc failure");
+		e->_rowsCap = height;
+	}
+	for (y = 0; y < height; ++y)
+		e->_rows[y] = (uint8_t *)pixels + stride * y;
+	e->outLen = 0;
+
+	png_ptr = png_create_write_struct_2(PNG_LIBPNG_VER_STRING,
+		NULL, NULL, NULL, e, arenaMalloc, arenaFree);
+	if (!png_ptr)
+		goto out;
+
+	info_ptr = png_create_info_struct(png_ptr);
+	if (!info_ptr)
+		goto out;
+
+	if (setjmp(png_jmpbuf(png_ptr)))
+		goto out;
+
+	// init output
+	png_set_write_fn(png_ptr, e, bufferWrite, bufferFlush);
+	png_set_compression_level(png_ptr, params->level);
+	png_set_compression_mem_level(png_ptr, 9);
+	png_set_compression_strategy(png_ptr, params->strategy);
+	png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE,
+		params->filter == FILTER_ADAPTIVE ? PNG_ALL_FILTERS : (PNG_FILTER_NONE << params->filter));
+
+	// set header info
+	png_set_IHDR(png_ptr, info_ptr, width, height, 2,
+			PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+
+	// set rows
+	png_set_rows(png_ptr, info_ptr, e->_rows);
+
+	// write png
+	png_write_info(png_ptr, info_ptr);
+	png_write_flush(png_ptr);
+	png_write_image(png_ptr, e->_rows);
+
+	png_text source_text;
+	source_text.compression = PNG_TEXT_COMPRESSION_NONE;
+	source_text.key = "Source";
+	source_text.text = "Nintendo Gameboy Camera";
+	png_set_text(png_ptr, info_ptr, &source_text, 1);
+
+	source_text.key = "Software";
+	source_text.text = "gbcamextract";
+	png_set_text(png_ptr, info_ptr, &source_text, 1);
+
+	png_write_end(png_ptr, info_ptr);
+	ok = true;
+
+out:
+	if (png_ptr)
+		png_destroy_write_struct(&png_ptr, info_ptr ? &info_ptr : NULL);
+	arenaReset(e);
+	return ok;
+}
+
+static void swapBuffers(struct PngEncoder_s *e)
+{
+	uint8_t *p = e->out;
+	size_t cap = e->_outCap;
+	e->out = e->_best;
+	e->_outCap = e->_bestCap;
+	e->_best = p;
+	e->_bestCap = cap;
+}
+
+// Encode with every setting of the profile, one after another, keeping the
+// smallest result.
+bool PngEncoder_Encode(struct PngEncoder_s *e, const uint8_t *pixels, int width, int height, int stride)
+{
+	const struct PngParams_s *params = profiles[e->profile].params;
+	int n = profiles[e->profile].numParams;
+	size_t bestLen = 0;
+	bool ok;
+
+	for (int i = 0; i < n; ++i) {
+		if (e->useLibpng)
+			ok = encodeLibpng(e, &params[i], pixels, width, height, stride);
+		else
+			ok = encodeBuiltin(e, &params[i], pixels, width, height, stride);
+		if (!ok)
+			return false;
+		if (n > 1 && (!bestLen || e->outLen < bestLen)) {
+			bestLen = e->outLen;
+			swapBuffers(e);
+		}
+	}
+	if (n > 1) {
+		swapBuffers(e);
+		e->outLen = bestLen;
+	}
+	return true;
+}
+
+void PngEncoder_Free(struct PngEncoder_s *e)
+{
+	if (e->_zReady)
+		deflateEnd(&e->_z);
+	free(e->out);
+	free(e->_best);
+	free(e->_scratch);
+	free(e->_raw);
+	free(e->_rows);
+	free(e->_arena);
+	memset(e, 0, sizeof(*e));
+}
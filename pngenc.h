@@ -0,0 +1,60 @@
+#ifndef _PNGENC_H_
+#define _PNGENC_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zlib.h>
+
+enum PngProfile_e {
+	PNG_PROFILE_BALANCED,	// the default: best compression, no filters
+	PNG_PROFILE_FAST,
+	PNG_PROFILE_SMALLEST,	// try several settings per image, keep the smallest
+};
+
+// Writes 2-bit grayscale PNGs into a buffer that is reused from one image
+// to the next. One encoder per thread. All of its state (output and row
+// buffers, the deflate stream, and an arena for libpng's allocations) is
+// kept between images, so after the first image nothing is allocated.
+struct PngEncoder_s {
+	bool useLibpng;
+	enum PngProfile_e profile;
+	uint8_t *out;
+	size_t outLen;
+	size_t _outCap;
+	uint8_t *_best;
+	size_t _bestCap;
+	uint8_t *_scratch;
+	size_t _scratchCap;
+	uint8_t *_raw;
+	size_t _rawCap;
+	uint8_t **_rows;
+	int _rowsCap;
+	z_stream _z;
+	bool _zReady;
+	uint8_t *_arena;
+	size_t _arenaCap;
+	size_t _arenaUsed;
+	size_t _arenaNeed;
+};
+
+// Colors for the four grays, darkest first, and a name for the files
+// written in them.
+struct PngPalette_s {
+	char name[16];
+	uint8_t rgb[4][3];
+};
+
+// What recoloring adds to a file: the PLTE chunk.
+#define PNG_PALETTE_CHUNK_SIZE 24
+
+void PngEncoder_Init(struct PngEncoder_s *e);
+bool PngEncoder_Encode(struct PngEncoder_s *e, const uint8_t *pixels, int width, int height, int stride);
+bool PngEncoder_ParseProfile(const char *name, enum PngProfile_e *profile);
+bool PngEncoder_ParsePalette(const char *spec, struct PngPalette_s *palette);
+size_t PngEncoder_Recolor(const uint8_t *png, size_t len, const struct PngPalette_s *palette,
+	uint8_t *out, size_t outCap);
+void PngEncoder_Free(struct PngEncoder_s *e);
+
+/* _PNGENC_H_ */
+#endif
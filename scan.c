@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2013-2020 jkbenaim et al.
+ *
+ * This program is free software; you may redistribute and/or modify it under
+ * the terms of the expat license (also known as the "MIT license").
+ *
+ * This program is distributed in the hope that it will be useful, but without
+ * any warranty; without even the implied warranty of merchantability or
+ * firness for a particular purpose.
+ *
+ * For the full license text, see LICENSE.
+ *
+ ******************************************************************************
+ *
+ * This file implements the recursive scan for saves (-R): a directory walk
+ * that the workers share, and that picks out the saves among everything
+ * else in the tree by their size and the start of their contents.
+ *
+ */
+
+#include "err_shim.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "gbcam.h"
+#include "scan.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#ifdef __MINGW32__
+#define lstat stat
+#endif
+
+// A directory to read, or in a batch just read, a save that was found.
+struct ScanDir_s {
+	char *path;
+	size_t rel;
+	bool save;
+	DIR *dir;	// open once its first batch has been read
+	struct ScanDir_s *next;
+};
+
+void Scan_Init(struct Scan_s *s)
+{
+	memset(s, 0, sizeof(*s));
+	pthread_cond_init(&s->_cond, NULL);
+}
+
+static char *joinPath(const char *dir, const char *name)
+{
+	size_t dirLen = strlen(dir), nameLen = strlen(name);
+	bool slash = dirLen && dir[dirLen-1] != '/';
+	char *path = malloc(dirLen + slash + nameLen + 1);
+
+	if (!path) err(1, "malloc failure");
+	memcpy(path, dir, dirLen);
+	if (slash)
+		path[dirLen] = '/';
+	memcpy(path + dirLen + slash, name, nameLen + 1);
+	return path;
+}
+
+static struct ScanDir_s *newEntry(char *path, size_t rel, bool save, struct ScanDir_s *next)
+{
+	struct ScanDir_s *d = calloc(1, sizeof(*d));
+
+	if (!d) err(1, "malloc failure");
+	d->path = path;
+	d->rel = rel;
+	d->save = save;
+	d->next = next;
+	return d;
+}
+
+static void pushFile(struct Scan_s *s, char *path, size_t rel)
+{
+	if (s->_count == s->_cap) {
+		size_t cap = s->_cap ? s->_cap * 2 : SCAN_BATCH;
+		struct ScanFile_s *p = realloc(s->_files, cap * sizeof(*p));
+		if (!p) err(1, "malloc failure");
+		s->_files = p;
+		s->_cap = cap;
+	}
+	s->_files[s->_count].path = path;
+	s->_files[s->_count].rel = rel;
+	s->_count++;
+}
+
+// Files under path are named relative to it in the output.
+void Scan_AddRoot(struct Scan_s *s, const char *path)
+{
+	size_t len = strlen(path);
+	char *root;
+
+	while (len > 1 && path[len-1] == '/')
+		len--;
+	root = malloc(len + 1);
+	if (!root) err(1, "malloc failure");
+	memcpy(root, path, len);
+	root[len] = '\0';
+	s->_dirs = newEntry(root, len + (root[len-1] != '/'), false, s->_dirs);
+	s->_numDirs++;
+}
+
+// Pops the next save found, or returns NULL if none are queued right now.
+char *Scan_Next(struct Scan_s *s, size_t *rel)
+{
+	struct ScanFile_s *f;
+
+	if (s->_head == s->_count)
+		return NULL;
+	f = &s->_files[s->_head++];
+	*rel = f->rel;
+	if (s->_head == s->_count)
+		s->_head = s->_count = 0;
+	return f->path;
+}
+
+// Only the start of the file is read, to check for the save's markers.
+static bool looksLikeSave(const char *path)
+{
+	uint8_t buf[GBCAM_SAVE_HEADER_SIZE];
+	size_t len = 0;
+	ssize_t n;
+	int fd = open(path, O_RDONLY | O_BINARY);
+
+	if (fd == -1)
+		return false;
+	while (len < sizeof(buf)) {
+		n = read(fd, buf + len, sizeof(buf) - len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		len += n;
+	}
+	close(fd);
+	return GbCam_IsSave(buf, len);
+}
+
+// Reads up to n entries of d, opening it first if this is its first
+// batch, and adds the saves and directories among them to *found. Returns
+// d's handle, or NULL once it has all been read. Symlinks are followed to
+// files but not to directories, so the walk can't go round in circles.
+static DIR *readBatch(const struct ScanDir_s *d, DIR *dir, int n, struct ScanDir_s **found, uint64_t *skipped, int *failures)
+{
+	struct dirent *de;
+	struct stat st;
+	char *path;
+
+	if (!dir && !(dir = opendir(d->path))) {
+		warn("couldn't open directory '%s'", d->path);
+		(*failures)++;
+		return NULL;
+	}
+	for (int i = 0; i < n; ++i) {
+		errno = 0;
+		if (!(de = readdir(dir))) {
+			if (errno) {
+				warn("couldn't read directory '%s'", d->path);
+				(*failures)++;
+			}
+			closedir(dir);
+			return NULL;
+		}
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+		path = joinPath(d->path, de->d_name);
+		if (lstat(path, &st)) {
+			warn("couldn't stat '%s'", path);
+			free(path);
+			continue;
+		}
+		if (S_ISDIR(st.st_mode)) {
+			*found = newEntry(path, d->rel, false, *found);
+			continue;
+		}
+#ifndef __MINGW32__
+		if (S_ISLNK(st.st_mode) && stat(path, &st))
+			st.st_mode = 0;
+#endif
+		if (S_ISREG(st.st_mode) && st.st_size == GBCAM_SAVE_SIZE && looksLikeSave(path)) {
+			*found = newEntry(path, d->rel, true, *found);
+			continue;
+		}
+		(*skipped)++;
+		free(path);
+	}
+	return dir;
+}
+
+// Called when no save is queued. Reads the next batch of the directory on
+// top of the stack, with lock released while it does. If there is none
+// but other workers are reading, waits for them instead, since their
+// batches may hold saves or more directories. Returns false once the walk
+// is over.
+bool Scan_Work(struct Scan_s *s, pthread_mutex_t *lock)
+{
+	struct ScanDir_s *d = s->_dirs, *found = NULL, *next;
+	DIR *dir;
+	int failures = 0, n;
+	uint64_t skipped = 0;
+
+	if (!d) {
+		if (!s->_busy)
+			return false;
+		pthread_cond_wait(&s->_cond, lock);
+		return true;
+	}
+	// Every entry of the batch may be a directory, so it reads no more
+	// entries than there is room for below the limit. The room is reserved
+	// now, so that batches read at the same time can't all take it. At the
+	// limit a batch is a single entry, so that the walk can go on.
+	n = s->_numDirs < SCAN_MAX_DIRS ? SCAN_MAX_DIRS - s->_numDirs : 1;
+	if (n > SCAN_BATCH)
+		n = SCAN_BATCH;
+	s->_numDirs += n;
+	s->_dirs = d->next;
+	s->_busy++;
+	pthread_mutex_unlock(lock);
+	dir = readBatch(d, d->dir, n, &found, &skipped, &failures);
+	pthread_mutex_lock(lock);
+	d->dir = dir;
+	s->_busy--;
+	s->_numDirs -= n;
+	s->skipped += skipped;
+	s->failures += failures;
+
+	// The rest of a directory is read before its subdirectories, so that
+	// it isn't left open while they are. At the limit it is the other way
+	// round: the walk goes depth first, finishing directories, until there
+	// is room again.
+	if (!d->dir) {
+		s->_numDirs--;
+		free(d->path);
+		free(d);
+		d = NULL;
+	} else if (s->_numDirs >= SCAN_MAX_DIRS) {
+		d->next = s->_dirs;
+		s->_dirs = d;
+		d = NULL;
+	}
+	for (; found; found = next) {
+		next = found->next;
+		if (found->save) {
+			pushFile(s, found->path, found->rel);
+			free(found);
+		} else {
+			found->next = s->_dirs;
+			s->_dirs = found;
+			s->_numDirs++;
+		}
+	}
+	if (d) {
+		d->next = s->_dirs;
+		s->_dirs = d;
+	}
+	pthread_cond_broadcast(&s->_cond);
+	return true;
+}
+
+void Scan_Free(struct Scan_s *s)
+{
+	while (s->_dirs) {
+		struct ScanDir_s *d = s->_dirs;
+		s->_dirs = d->next;
+		if (d->dir)
+			closedir(d->dir);
+		free(d->path);
+		free(d);
+	}
+	for (size_t i = s->_head; i < s->_count; ++i)
+		free(s->_files[i].path);
+	free(s->_files);
+	pthread_cond_destroy(&s->_cond);
+}
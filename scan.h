@@ -0,0 +1,63 @@
+#ifndef _SCAN_H_
+#define _SCAN_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Directory entries read at a time. A batch is classified with the lock
+// released, and adds at most this many saves to the queue.
+#define SCAN_BATCH 256
+
+// Directories found but not yet finished. The walk stops taking in new
+// ones at this many; see Scan_s.
+#define SCAN_MAX_DIRS 4096
+
+struct ScanDir_s;
+
+struct ScanFile_s {
+	char *path;
+	size_t rel;	// where the part below the scanned directory starts
+};
+
+// A recursive walk of directories for saves, shared by the workers. Any
+// worker with nothing else to do reads the next batch of whichever
+// directory is on top of the stack, so the walk runs in parallel with
+// extraction and with itself. Only files of the right size that start
+// like a save are queued; nothing else is opened past its first few
+// kilobytes, or mapped at all.
+//
+// Memory is bounded: directories are read in batches, a partly read one
+// goes back on top of the stack so that about one is open per worker,
+// and batches are only read when the queue of saves is empty, so that
+// queue holds at most SCAN_BATCH saves per worker. The stack holds the
+// paths of directories not yet read, SCAN_MAX_DIRS of them at most, plus
+// one per level of the tree: a batch reads no more entries than there is
+// room for, and once it is full, a batch is one entry and the walk goes
+// depth first, into the directories it finds, until some are finished.
+// Open directories are then bounded by the depth of the tree.
+//
+// Everything but Scan_Init and Scan_Free is called with the caller's lock
+// held.
+struct Scan_s {
+	uint64_t skipped;	// files that weren't saves
+	int failures;		// directories that couldn't be read
+	pthread_cond_t _cond;
+	struct ScanDir_s *_dirs;
+	int _numDirs;		// in _dirs or being read, and reserved
+	int _busy;		// batches being read
+	struct ScanFile_s *_files;
+	size_t _head;
+	size_t _count;
+	size_t _cap;
+};
+
+void Scan_Init(struct Scan_s *s);
+void Scan_AddRoot(struct Scan_s *s, const char *path);
+char *Scan_Next(struct Scan_s *s, size_t *rel);
+bool Scan_Work(struct Scan_s *s, pthread_mutex_t *lock);
+void Scan_Free(struct Scan_s *s);
+
+/* _SCAN_H_ */
+#endif
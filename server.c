@@ -0,0 +1,641 @@
+/*
+ * Copyright (c) 2013-2020 jkbenaim et al.
+ *
+ * This program is free software; you may redistribute and/or modify it under
+ * the terms of the expat license (also known as the "MIT license").
+ *
+ * This program is distributed in the hope that it will be useful, but without
+ * any warranty; without even the implied warranty of merchantability or
+ * firness for a particular purpose.
+ *
+ * For the full license text, see LICENSE.
+ *
+ ******************************************************************************
+ *
+ * This file implements daemon mode, a server on a Unix domain socket, and
+ * the client that talks to it.
+ *
+ */
+
+#ifndef __MINGW32__
+
+#include "err_shim.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "gbcam.h"
+#include "server.h"
+
+#define HEADER_MAX 64
+#define IO_TIMEOUT 10	// seconds a client may stall before it is dropped
+
+enum Stage_e {
+	STAGE_RECEIVE,
+	STAGE_DECODE,
+	STAGE_ENCODE,
+	STAGE_WRITE,
+	NUM_STAGES,
+};
+
+static const char *stageNames[NUM_STAGES] = {"receive", "decode", "encode", "write"};
+
+struct StageStats_s {
+	uint64_t count;
+	uint64_t totalNs;
+	uint64_t maxNs;
+};
+
+// The accept loop puts connections on a bounded queue; when it is full the
+// client is told so straight away instead of waiting.
+static struct {
+	const struct ServerConfig_s *cfg;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	int queue[SERVER_QUEUE_SIZE];
+	int head;
+	int depth;
+	int maxDepth;
+	bool stop;
+	uint64_t requests;
+	uint64_t failed;
+	uint64_t rejected;
+	uint64_t bytesIn;
+	uint64_t bytesOut;
+	struct StageStats_s stages[NUM_STAGES];
+} server = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.ready = PTHREAD_COND_INITIALIZER,
+};
+
+// The stop signals write to this pipe, which the accept loop polls along
+// with the listening socket, so a signal that lands just before the loop
+// would block in accept() still wakes it.
+static int stopPipe[2] = {-1, -1};
+
+struct ServerWorker_s {
+	uint8_t save[GBCAM_SAVE_SIZE];
+	uint8_t pixelBuffer[GBCAM_IMAGE_SIZE];
+	struct ImageEncoder_s enc;
+	uint64_t stageNs[NUM_STAGES];
+	uint64_t bytesOut;
+};
+
+static uint64_t nowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool sendAll(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = send(fd, p, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+static void sendError(int fd, const char *reason)
+{
+	char line[HEADER_MAX * 2];
+	int len = snprintf(line, sizeof(line), "error %s\n", reason);
+	sendAll(fd, line, len);
+}
+
+// Read the request line. Bytes that arrive after it are left in line past
+// the newline; *extra says how many. A passed fd is returned in *fd.
+static bool readHeader(int sock, char line[HEADER_MAX], size_t *extra, int *fd)
+{
+	size_t len = 0;
+	char *nl;
+
+	*fd = -1;
+	for (;;) {
+		union {
+			struct cmsghdr h;
+			char buf[CMSG_SPACE(sizeof(int))];
+		} control;
+		struct iovec iov = {line + len, HEADER_MAX - 1 - len};
+		struct msghdr msg = {
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+			.msg_control = control.buf,
+			.msg_controllen = sizeof(control.buf),
+		};
+		struct cmsghdr *c;
+		ssize_t n = recvmsg(sock, &msg, 0);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		for (c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c))
+			if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+				int passed;
+				memcpy(&passed, CMSG_DATA(c), sizeof(passed));
+				if (*fd == -1)
+					*fd = passed;
+				else
+					close(passed);
+			}
+		len += n;
+		line[len] = '\0';
+		nl = memchr(line, '\n', len);
+		if (nl) {
+			*nl = '\0';
+			*extra = len - (nl + 1 - line);
+			return true;
+		}
+		if (len == HEADER_MAX - 1)
+			return false;
+	}
+}
+
+// These return NULL once the save is in w->save, or else the reason it
+// isn't, for the error line.
+static const char *readSave(struct ServerWorker_s *w, int sock, const char *have, size_t haveLen)
+{
+	size_t len = haveLen;
+	ssize_t n;
+
+	memcpy(w->save, have, haveLen);
+	while (len < GBCAM_SAVE_SIZE) {
+		n = recv(sock, w->save + len, GBCAM_SAVE_SIZE - len, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return "couldn't read savegame";
+		if (n == 0)
+			return "savegame ended early";
+		len += n;
+	}
+	return NULL;
+}
+
+static const char *readSaveFd(struct ServerWorker_s *w, int fd)
+{
+	struct stat st;
+	size_t len = 0;
+	ssize_t n;
+
+	if (fd == -1)
+		return "no file descriptor received";
+	if (fstat(fd, &st))
+		return "couldn't read savegame";
+	if (st.st_size != GBCAM_SAVE_SIZE)
+		return "savegame has weird size";
+	while (len < GBCAM_SAVE_SIZE) {
+		n = pread(fd, w->save + len, GBCAM_SAVE_SIZE - len, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return "couldn't read savegame";
+		if (n == 0)
+			return "savegame ended early";
+		len += n;
+	}
+	return NULL;
+}
+
+static void addStage(struct ServerWorker_s *w, enum Stage_e stage, uint64_t *t)
+{
+	uint64_t now = nowNs();
+	w->stageNs[stage] += now - *t;
+	*t = now;
+}
+
+static void sendStats(int sock)
+{
+	char text[1024];
+	int len;
+
+	pthread_mutex_lock(&server.lock);
+	len = snprintf(text, sizeof(text),
+		"workers %d\nqueue_depth %d\nqueue_max_depth %d\nqueue_capacity %d\n"
+		"requests %" PRIu64 "\nfailed %" PRIu64 "\nrejected %" PRIu64 "\n"
+		"bytes_in %" PRIu64 "\nbytes_out %" PRIu64 "\n"
+		"# stage count total_us mean_us max_us\n",
+		server.cfg->threads, server.depth, server.maxDepth, SERVER_QUEUE_SIZE,
+		server.requests, server.failed, server.rejected,
+		server.bytesIn, server.bytesOut);
+	for (int i = 0; i < NUM_STAGES; ++i) {
+		const struct StageStats_s *s = &server.stages[i];
+		len += snprintf(text + len, sizeof(text) - len,
+			"%s %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+			stageNames[i], s->count, s->totalNs / 1000,
+			s->count ? s->totalNs / s->count / 1000 : 0, s->maxNs / 1000);
+	}
+	pthread_mutex_unlock(&server.lock);
+
+	if (sendAll(sock, "ok\n", 3))
+		sendAll(sock, text, len);
+}
+
+static void handleRequest(struct ServerWorker_s *w, int sock)
+{
+	char line[HEADER_MAX], kindName[8], lenText[16];
+	enum OutputKind_e kind;
+	struct GbCam_Save_s save;
+	struct Output_s out;
+	const char *error;
+	size_t extra;
+	int fd;
+	uint64_t t = nowNs();
+	bool ok = true;
+
+	memset(w->stageNs, 0, sizeof(w->stageNs));
+	w->bytesOut = 0;
+	if (!readHeader(sock, line, &extra, &fd)) {
+		sendError(sock, "bad request");
+		goto out_failed;
+	}
+	if (!strcmp(line, "stats")) {
+		sendStats(sock);
+		goto out_close;
+	}
+	if (sscanf(line, "extract %7s %15s", kindName, lenText) != 2
+	 || !Output_ParseKind(kindName, &kind) || kind == OUTPUT_FILES) {
+		sendError(sock, "bad request");
+		goto out_failed;
+	}
+	if (!strcmp(lenText, "fd")) {
+		error = readSaveFd(w, fd);
+	} else {
+		char *end;
+		unsigned long len = strtoul(lenText, &end, 10);
+		if (*end)
+			error = "bad request";
+		else if (len != GBCAM_SAVE_SIZE || extra > len)
+			error = "savegame has weird size";
+		else
+			error = readSave(w, sock, line + strlen(line) + 1, extra);
+	}
+	if (error) {
+		sendError(sock, error);
+		goto out_failed;
+	}
+	if (GbCam_OpenSave(&save, w->save, GBCAM_SAVE_SIZE) != GBCAM_OK) {
+		sendError(sock, "save expected, but rom was given");
+		goto out_failed;
+	}
+	addStage(w, STAGE_RECEIVE, &t);
+
+	if (!sendAll(sock, "ok\n", 3))
+		goto out_failed;
+	Output_Open(&out, kind, sock);
+	for (int slotNum = 1; slotNum <= GBCAM_NUM_SLOTS && ok; ++slotNum) {
+		int picNum = GbCam_SlotPicture(&save, slotNum);
+		char filename[16];
+
+		GbCam_DecodeSlot(&save, server.cfg->rom, slotNum, w->pixelBuffer, sizeof(w->pixelBuffer));
+		addStage(w, STAGE_DECODE, &t);
+		snprintf(filename, sizeof(filename), "%s_%02d.%s", picNum ? "IMG" : "DEL",
+			picNum ? picNum : slotNum, ImageEncoder_Extension(server.cfg->format));
+		ok = ImageEncoder_Encode(&w->enc, w->pixelBuffer, GBCAM_WIDTH, GBCAM_HEIGHT, GBCAM_STRIDE);
+		addStage(w, STAGE_ENCODE, &t);
+		ok = ok && Output_Write(&out, filename, w->enc.out, w->enc.outLen);
+		w->bytesOut += w->enc.outLen;
+		addStage(w, STAGE_WRITE, &t);
+	}
+	ok = Output_Close(&out) && ok;
+	addStage(w, STAGE_WRITE, &t);
+
+	pthread_mutex_lock(&server.lock);
+	server.requests++;
+	server.failed += !ok;
+	server.bytesIn += GBCAM_SAVE_SIZE;
+	server.bytesOut += w->bytesOut;
+	for (int i = 0; i < NUM_STAGES; ++i) {
+		struct StageStats_s *s = &server.stages[i];
+		s->count++;
+		s->totalNs += w->stageNs[i];
+		if (w->stageNs[i] > s->maxNs)
+			s->maxNs = w->stageNs[i];
+	}
+	pthread_mutex_unlock(&server.lock);
+	goto out_close;
+
+out_failed:
+	pthread_mutex_lock(&server.lock);
+	server.requests++;
+	server.failed++;
+	pthread_mutex_unlock(&server.lock);
+out_close:
+	if (fd != -1)
+		close(fd);
+	close(sock);
+}
+
+static void *serverWorker(void *arg)
+{
+	struct ServerWorker_s *w = calloc(1, sizeof(*w));
+	if (!w) err(1, "malloc failure");
+
+	ImageEncoder_Init(&w->enc, server.cfg->format);
+	w->enc.png.useLibpng = !server.cfg->builtinPng;
+	w->enc.png.profile = server.cfg->profile;
+
+	for (;;) {
+		int sock;
+
+		pthread_mutex_lock(&server.lock);
+		while (!server.depth && !server.stop)
+			pthread_cond_wait(&server.ready, &server.lock);
+		if (!server.depth) {
+			pthread_mutex_unlock(&server.lock);
+			break;
+		}
+		sock = server.queue[server.head];
+		server.head = (server.head + 1) % SERVER_QUEUE_SIZE;
+		server.depth--;
+		pthread_mutex_unlock(&server.lock);
+
+		handleRequest(w, sock);
+	}
+
+	ImageEncoder_Free(&w->enc);
+	free(w);
+	return NULL;
+}
+
+static void onSignal(int sig)
+{
+	int saved = errno;
+	if (write(stopPipe[1], "", 1) < 0) {
+		// The pipe is full, so a stop is already pending.
+	}
+	errno = saved;
+}
+
+static bool setNonblocking(int fd, bool on)
+{
+	int flags = fcntl(fd, F_GETFL);
+	if (flags == -1)
+		return false;
+	flags = on ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+	return fcntl(fd, F_SETFL, flags) == 0;
+}
+
+static bool socketAddress(struct sockaddr_un *addr, const char *path)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		warnx("'%s': socket path too long", path);
+		return false;
+	}
+	strcpy(addr->sun_path, path);
+	return true;
+}
+
+// Runs until SIGINT or SIGTERM. Requests already queued are finished
+// before it returns.
+bool Server_Run(const struct ServerConfig_s *cfg)
+{
+	struct sockaddr_un addr;
+	struct sigaction sa = {.sa_handler = onSignal};
+	struct timeval timeout = {IO_TIMEOUT, 0};
+	struct pollfd fds[2];
+	sigset_t stopSignals, old;
+	pthread_t *threads;
+	int listener;
+
+	if (!socketAddress(&addr, cfg->path))
+		return false;
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener == -1) {
+		warn("couldn't create socket");
+		return false;
+	}
+	// A socket file left behind by a dead server is replaced; a live one
+	// is not.
+	if (connect(listener, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+		warnx("'%s': a server is already running", cfg->path);
+		close(listener);
+		return false;
+	}
+	unlink(cfg->path);
+	if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) || listen(listener, SERVER_QUEUE_SIZE)) {
+		warn("couldn't listen on '%s'", cfg->path);
+		close(listener);
+		return false;
+	}
+	// The listener doesn't block either, in case a client gives up
+	// between poll() and accept().
+	if (pipe(stopPipe) || !setNonblocking(stopPipe[0], true) || !setNonblocking(stopPipe[1], true)
+	 || !setNonblocking(listener, true)) {
+		warn("couldn't set up the daemon");
+		close(listener);
+		unlink(cfg->path);
+		return false;
+	}
+
+	server.cfg = cfg;
+	signal(SIGPIPE, SIG_IGN);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	// Only this thread takes the stop signals.
+	sigemptyset(&stopSignals);
+	sigaddset(&stopSignals, SIGINT);
+	sigaddset(&stopSignals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &stopSignals, &old);
+	threads = calloc(cfg->threads, sizeof(pthread_t));
+	if (!threads) err(1, "malloc failure");
+	for (int i = 0; i < cfg->threads; ++i)
+		if ((errno = pthread_create(&threads[i], NULL, serverWorker, NULL)))
+			err(1, "couldn't start worker thread");
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	fds[0] = (struct pollfd){.fd = listener, .events = POLLIN};
+	fds[1] = (struct pollfd){.fd = stopPipe[0], .events = POLLIN};
+	for (;;) {
+		int sock;
+
+		if (poll(fds, 2, -1) == -1) {
+			if (errno != EINTR)
+				warn("poll failed");
+			continue;
+		}
+		if (fds[1].revents)
+			break;
+		sock = accept(listener, NULL, NULL);
+		if (sock == -1) {
+			if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN && errno != EWOULDBLOCK)
+				warn("accept failed");
+			continue;
+		}
+		// Some systems pass O_NONBLOCK on from the listener.
+		setNonblocking(sock, false);
+		setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		pthread_mutex_lock(&server.lock);
+		if (server.depth == SERVER_QUEUE_SIZE) {
+			server.rejected++;
+			pthread_mutex_unlock(&server.lock);
+			sendError(sock, "busy");
+			close(sock);
+			continue;
+		}
+		server.queue[(server.head + server.depth) % SERVER_QUEUE_SIZE] = sock;
+		if (++server.depth > server.maxDepth)
+			server.maxDepth = server.depth;
+		pthread_cond_signal(&server.ready);
+		pthread_mutex_unlock(&server.lock);
+	}
+
+	close(listener);
+	close(stopPipe[0]);
+	close(stopPipe[1]);
+	unlink(cfg->path);
+	pthread_mutex_lock(&server.lock);
+	server.stop = true;
+	pthread_cond_broadcast(&server.ready);
+	pthread_mutex_unlock(&server.lock);
+	for (int i = 0; i < cfg->threads; ++i)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	return true;
+}
+
+// Send one request and copy the answer to outFd. With no save this asks
+// for the stats. A save named "-" is read from stdin and sent as bytes;
+// otherwise its fd is passed to the server.
+bool Server_Request(const char *path, const char *filename_save, enum OutputKind_e kind, int outFd)
+{
+	struct sockaddr_un addr;
+	char line[HEADER_MAX], buf[65536];
+	const char *kindName = kind == OUTPUT_ZIP ? "zip" : "tar";
+	uint8_t *save = NULL;
+	size_t len = 0;
+	int sock, fd = -1, lineLen;
+	ssize_t n;
+	bool ok = false;
+
+	if (!socketAddress(&addr, path))
+		return false;
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock == -1) {
+		warn("couldn't create socket");
+		return false;
+	}
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+		warn("couldn't connect to '%s'", path);
+		goto out;
+	}
+
+	if (!filename_save) {
+		lineLen = snprintf(line, sizeof(line), "stats\n");
+	} else if (!strcmp(filename_save, "-")) {
+		save = malloc(GBCAM_SAVE_SIZE + 1);
+		if (!save) err(1, "malloc failure");
+		while (len <= GBCAM_SAVE_SIZE && (n = read(0, save + len, GBCAM_SAVE_SIZE + 1 - len)) > 0)
+			len += n;
+		if (len != GBCAM_SAVE_SIZE) {
+			warnx("-: savegame has weird size");
+			goto out;
+		}
+		lineLen = snprintf(line, sizeof(line), "extract %s %zu\n", kindName, len);
+	} else {
+		fd = open(filename_save, O_RDONLY);
+		if (fd == -1) {
+			warn("couldn't open save '%s' for reading", filename_save);
+			goto out;
+		}
+		lineLen = snprintf(line, sizeof(line), "extract %s fd\n", kindName);
+	}
+
+	if (fd != -1) {
+		union {
+			struct cmsghdr h;
+			char buf[CMSG_SPACE(sizeof(int))];
+		} control;
+		struct iovec iov = {line, lineLen};
+		struct msghdr msg = {
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+			.msg_control = control.buf,
+			.msg_controllen = sizeof(control.buf),
+		};
+		struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+
+		c->cmsg_level = SOL_SOCKET;
+		c->cmsg_type = SCM_RIGHTS;
+		c->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(c), &fd, sizeof(int));
+		if (sendmsg(sock, &msg, MSG_NOSIGNAL) != lineLen) {
+			warn("couldn't send request");
+			goto out;
+		}
+	} else if (!sendAll(sock, line, lineLen) || (save && !sendAll(sock, save, len))) {
+		warn("couldn't send request");
+		goto out;
+	}
+
+	// The answer is a line, then the body until the server hangs up.
+	lineLen = 0;
+	while (lineLen < HEADER_MAX - 1 && (n = recv(sock, line + lineLen, 1, 0)) == 1 && line[lineLen] != '\n')
+		lineLen++;
+	line[lineLen] = '\0';
+	if (strcmp(line, "ok")) {
+		if (!strncmp(line, "error ", 6))
+			warnx("server: %s", line + 6);
+		else
+			warnx("no answer from server");
+		goto out;
+	}
+	ok = true;
+	while ((n = recv(sock, buf, sizeof(buf), 0)) > 0) {
+		const char *p = buf;
+		while (n > 0) {
+			ssize_t w = write(outFd, p, n);
+			if (w < 0 && errno == EINTR)
+				continue;
+			if (w <= 0) {
+				warn("couldn't write output");
+				ok = false;
+				goto out;
+			}
+			p += w;
+			n -= w;
+		}
+	}
+	if (n < 0) {
+		warn("connection to server lost");
+		ok = false;
+	}
+
+out:
+	free(save);
+	if (fd != -1)
+		close(fd);
+	close(sock);
+	return ok;
+}
+
+/* __MINGW32__ */
+#endif
@@ -0,0 +1,34 @@
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <stdbool.h>
+#include "frame.h"
+#include "output.h"
+#include "imgenc.h"
+#include "pngenc.h"
+
+#define SERVER_QUEUE_SIZE 64
+
+// A long-running extractor listening on a Unix domain socket. The frames
+// and the workers' encoders stay warm between requests.
+//
+// Protocol, one request per connection. The client sends one line:
+//	extract <tar|zip> <length>\n	followed by the save's bytes
+//	extract <tar|zip> fd\n		with the save's fd passed as SCM_RIGHTS
+//	stats\n
+// and the server answers "ok\n" and the archive (or stats text) up to
+// the end of the connection, or "error <reason>\n".
+struct ServerConfig_s {
+	const char *path;
+	struct GbCam_Rom_s *rom;
+	int threads;
+	enum ImageFormat_e format;
+	bool builtinPng;
+	enum PngProfile_e profile;
+};
+
+bool Server_Run(const struct ServerConfig_s *cfg);
+bool Server_Request(const char *path, const char *filename_save, enum OutputKind_e kind, int outFd);
+
+/* _SERVER_H_ */
+#endif
@@ -45,6 +45,9 @@ struct firstslot_s {
 	uint8_t vec[0x11d0-0x11b2];
 	uint8_t magic[5];	// ASCI "Magic" without null byte
 	uint16_t checksum;
+	uint8_t vec2[0x11d0-0x11b2];	// echo of the above
+	uint8_t magic2[5];
+	uint16_t checksum2;
 } __attribute__((packed));
 
 #endif
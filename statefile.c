@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2013-2020 jkbenaim et al.
+ *
+ * This program is free software; you may redistribute and/or modify it under
+ * the terms of the expat license (also known as the "MIT license").
+ *
+ * This program is distributed in the hope that it will be useful, but without
+ * any warranty; without even the implied warranty of merchantability or
+ * firness for a particular purpose.
+ *
+ * For the full license text, see LICENSE.
+ *
+ ******************************************************************************
+ *
+ * This file implements the state file of incremental mode. It sits in a
+ * save's output directory and has one line per slot that was written:
+ *
+ *   slot input-hash output-hash size filename
+ *
+ */
+
+#include "err_shim.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "statefile.h"
+
+#define STATEFILE_HEADER "# gbcamextract state 1"
+
+#define STR_(x) #x
+#define STR(x) STR_(x)
+
+static void statePath(char *dst, size_t len, const char *dir)
+{
+	if (*dir)
+		snprintf(dst, len, "%s/%s", dir, STATEFILE_NAME);
+	else
+		snprintf(dst, len, "%s", STATEFILE_NAME);
+}
+
+// A missing or unreadable state file just means every slot is written.
+void StateFile_Load(const char *dir, struct StateEntry_s entries[30])
+{
+	char path[PATH_MAX], line[256];
+	char name[STATEFILE_NAME_SIZE + 1];
+	struct StateEntry_s e;
+	int slot;
+	FILE *f;
+
+	memset(entries, 0, 30 * sizeof(*entries));
+	statePath(path, sizeof(path), dir);
+	f = fopen(path, "r");
+	if (!f)
+		return;
+	if (!fgets(line, sizeof(line), f) || strcmp(line, STATEFILE_HEADER "\n")) {
+		fclose(f);
+		return;
+	}
+	// A name that is too long to be one of ours is read one character too
+	// far, and the line is dropped rather than truncated.
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%d %" SCNx64 " %" SCNx64 " %" SCNu64 " %" STR(STATEFILE_NAME_SIZE) "s",
+			&slot, &e.input, &e.output, &e.size, name) != 5)
+			continue;
+		if (strlen(name) >= sizeof(e.name))
+			continue;
+		memcpy(e.name, name, strlen(name) + 1);
+		if (slot >= 1 && slot <= 30)
+			entries[slot-1] = e;
+	}
+	fclose(f);
+}
+
+bool StateFile_Store(const char *dir, const struct StateEntry_s entries[30])
+{
+	char path[PATH_MAX], tmp[PATH_MAX + 32];
+	FILE *f;
+
+	statePath(path, sizeof(path), dir);
+	snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+	if (!(f = fopen(tmp, "w"))) {
+		warn("couldn't write state file '%s'", tmp);
+		return false;
+	}
+	fprintf(f, STATEFILE_HEADER "\n");
+	for (int i = 0; i < 30; ++i)
+		if (entries[i].input)
+			fprintf(f, "%d %016" PRIx64 " %016" PRIx64 " %" PRIu64 " %s\n", i + 1,
+				entries[i].input, entries[i].output, entries[i].size, entries[i].name);
+	if (fclose(f)) {
+		warn("couldn't write state file '%s'", tmp);
+		remove(tmp);
+		return false;
+	}
+#ifdef __MINGW32__
+	remove(path);
+#endif
+	if (rename(tmp, path)) {
+		warn("couldn't write state file '%s'", path);
+		remove(tmp);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,23 @@
+#ifndef _STATEFILE_H_
+#define _STATEFILE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define STATEFILE_NAME ".gbcamextract-state"
+#define STATEFILE_NAME_SIZE 64
+
+// What the last incremental run wrote for one slot. input is a hash of
+// everything the image is made from; an input of 0 means nothing is known.
+struct StateEntry_s {
+	uint64_t input;
+	uint64_t output;	// hash of the file written
+	uint64_t size;		// and its size
+	char name[STATEFILE_NAME_SIZE];
+};
+
+void StateFile_Load(const char *dir, struct StateEntry_s entries[30]);
+bool StateFile_Store(const char *dir, const struct StateEntry_s entries[30]);
+
+/* _STATEFILE_H_ */
+#endif
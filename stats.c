@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2013-2020 jkbenaim et al.
+ *
+ * This program is free software; you may redistribute and/or modify it under
+ * the terms of the expat license (also known as the "MIT license").
+ *
+ * This program is distributed in the hope that it will be useful, but without
+ * any warranty; without even the implied warranty of merchantability or
+ * firness for a particular purpose.
+ *
+ * For the full license text, see LICENSE.
+ *
+ ******************************************************************************
+ *
+ * This file implements the --stats report.
+ *
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifndef __MINGW32__
+#include <sys/resource.h>
+#endif
+#include "stats.h"
+
+bool statsEnabled;
+
+static const char *stageNames[STATS_NUM_STAGES] = {"open", "decode", "encode", "write"};
+
+bool Stats_ParseFormat(const char *name, enum StatsFormat_e *format)
+{
+	if (!strcmp(name, "text"))
+		*format = STATS_TEXT;
+	else if (!strcmp(name, "json"))
+		*format = STATS_JSON;
+	else
+		return false;
+	return true;
+}
+
+static void addTime(struct StatsTime_s *dst, const struct StatsTime_s *src)
+{
+	dst->count += src->count;
+	dst->wallNs += src->wallNs;
+	dst->cpuNs += src->cpuNs;
+}
+
+void Stats_Add(struct Stats_s *dst, const struct Stats_s *src)
+{
+	for (int i = 0; i < STATS_NUM_STAGES; ++i)
+		addTime(&dst->stages[i], &src->stages[i]);
+	for (int i = 0; i < 30; ++i) {
+		addTime(&dst->slots[i], &src->slots[i]);
+		dst->slotBytes[i] += src->slotBytes[i];
+	}
+	dst->saves += src->saves;
+	dst->activeSlots += src->activeSlots;
+	dst->deletedSlots += src->deletedSlots;
+	dst->skippedSlots += src->skippedSlots;
+	dst->memoHits += src->memoHits;
+	dst->skippedFiles += src->skippedFiles;
+	dst->bytesIn += src->bytesIn;
+	dst->bytesOut += src->bytesOut;
+	dst->rawBytes += src->rawBytes;
+}
+
+static double ms(uint64_t ns)
+{
+	return ns / 1e6;
+}
+
+// Wall time is since start; CPU time is the whole process's, all threads.
+void Stats_Print(FILE *f, const struct Stats_s *s, enum StatsFormat_e format, const struct StatsClock_s *start)
+{
+	struct StatsClock_s now;
+	struct timespec ts;
+	uint64_t cpuNs;
+	long minorFaults = -1, majorFaults = -1;
+	double ratio = s->rawBytes ? (double)s->bytesOut / s->rawBytes : 0;
+
+	Stats_Now(&now);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	cpuNs = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#ifndef __MINGW32__
+	struct rusage ru;
+	if (!getrusage(RUSAGE_SELF, &ru)) {
+		minorFaults = ru.ru_minflt;
+		majorFaults = ru.ru_majflt;
+	}
+#endif
+
+	if (format == STATS_JSON) {
+		fprintf(f, "{\"wall_ms\":%.3f,\"cpu_ms\":%.3f,\"saves\":%" PRIu64 ","
+			"\"active_slots\":%" PRIu64 ",\"deleted_slots\":%" PRIu64 ",\"skipped_slots\":%" PRIu64 ","
+			"\"memo_hits\":%" PRIu64 ",\"skipped_files\":%" PRIu64 ","
+			"\"bytes_in\":%" PRIu64 ",\"bytes_out\":%" PRIu64 ",\"raw_bytes\":%" PRIu64 ","
+			"\"ratio\":%.4f,\"minor_faults\":%ld,\"major_faults\":%ld,\"stages\":{",
+			ms(now.wallNs - start->wallNs), ms(cpuNs), s->saves,
+			s->activeSlots, s->deletedSlots, s->skippedSlots, s->memoHits, s->skippedFiles,
+			s->bytesIn, s->bytesOut, s->rawBytes,
+			ratio, minorFaults, majorFaults);
+		for (int i = 0; i < STATS_NUM_STAGES; ++i)
+			fprintf(f, "%s\"%s\":{\"count\":%" PRIu64 ",\"wall_ms\":%.3f,\"cpu_ms\":%.3f}",
+				i ? "," : "", stageNames[i], s->stages[i].count,
+				ms(s->stages[i].wallNs), ms(s->stages[i].cpuNs));
+		fprintf(f, "},\"slots\":[");
+		for (int i = 0; i < 30; ++i)
+			fprintf(f, "%s{\"slot\":%d,\"count\":%" PRIu64 ",\"wall_ms\":%.3f,\"cpu_ms\":%.3f,\"bytes_out\":%" PRIu64 "}",
+				i ? "," : "", i + 1, s->slots[i].count,
+				ms(s->slots[i].wallNs), ms(s->slots[i].cpuNs), s->slotBytes[i]);
+		fprintf(f, "]}\n");
+		return;
+	}
+
+	fprintf(f, "# stats\n"
+		"wall_ms %.3f\ncpu_ms %.3f\nsaves %" PRIu64 "\n"
+		"active_slots %" PRIu64 "\ndeleted_slots %" PRIu64 "\nskipped_slots %" PRIu64 "\n"
+		"memo_hits %" PRIu64 "\nskipped_files %" PRIu64 "\n"
+		"bytes_in %" PRIu64 "\nbytes_out %" PRIu64 "\nraw_bytes %" PRIu64 "\n"
+		"ratio %.4f\nminor_faults %ld\nmajor_faults %ld\n",
+		ms(now.wallNs - start->wallNs), ms(cpuNs), s->saves,
+		s->activeSlots, s->deletedSlots, s->skippedSlots, s->memoHits, s->skippedFiles,
+		s->bytesIn, s->bytesOut, s->rawBytes,
+		ratio, minorFaults, majorFaults);
+	fprintf(f, "# stage count wall_ms cpu_ms\n");
+	for (int i = 0; i < STATS_NUM_STAGES; ++i)
+		fprintf(f, "%s %" PRIu64 " %.3f %.3f\n", stageNames[i], s->stages[i].count,
+			ms(s->stages[i].wallNs), ms(s->stages[i].cpuNs));
+	fprintf(f, "# slot count wall_ms cpu_ms bytes_out\n");
+	for (int i = 0; i < 30; ++i)
+		fprintf(f, "%d %" PRIu64 " %.3f %.3f %" PRIu64 "\n", i + 1, s->slots[i].count,
+			ms(s->slots[i].wallNs), ms(s->slots[i].cpuNs), s->slotBytes[i]);
+}
@@ -0,0 +1,90 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+enum StatsFormat_e {
+	STATS_TEXT,
+	STATS_JSON,
+};
+
+enum StatsStage_e {
+	STATS_OPEN,	// mapping and checking a save
+	STATS_DECODE,	// tiles to pixels, including page faults on the save
+	STATS_ENCODE,	// PNG encoding
+	STATS_WRITE,	// handing the file to the output
+	STATS_NUM_STAGES,
+};
+
+struct StatsTime_s {
+	uint64_t count;
+	uint64_t wallNs;
+	uint64_t cpuNs;
+};
+
+// Counters for --stats. Each worker keeps its own, and they are added up
+// at the end, so nothing here is shared between threads.
+struct Stats_s {
+	struct StatsTime_s stages[STATS_NUM_STAGES];
+	struct StatsTime_s slots[30];
+	uint64_t slotBytes[30];
+	uint64_t saves;
+	uint64_t activeSlots;
+	uint64_t deletedSlots;
+	uint64_t skippedSlots;
+	uint64_t memoHits;	// images found already encoded
+	uint64_t skippedFiles;	// files found by -R that weren't saves
+	uint64_t bytesIn;
+	uint64_t bytesOut;
+	uint64_t rawBytes;
+};
+
+// A point in time on the wall and CPU clocks.
+struct StatsClock_s {
+	uint64_t wallNs;
+	uint64_t cpuNs;
+};
+
+extern bool statsEnabled;
+
+static inline void Stats_Now(struct StatsClock_s *c)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	c->wallNs = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	c->cpuNs = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// The probes. With --stats off they are a branch on statsEnabled and
+// nothing else.
+static inline void Stats_Begin(struct StatsClock_s *c)
+{
+	if (statsEnabled)
+		Stats_Now(c);
+}
+
+// Adds the time since *c to t, and restarts *c.
+static inline void Stats_End(struct StatsTime_s *t, struct StatsClock_s *c)
+{
+	struct StatsClock_s now;
+
+	if (!statsEnabled)
+		return;
+	Stats_Now(&now);
+	t->count++;
+	t->wallNs += now.wallNs - c->wallNs;
+	t->cpuNs += now.cpuNs - c->cpuNs;
+	*c = now;
+}
+
+bool Stats_ParseFormat(const char *name, enum StatsFormat_e *format);
+void Stats_Add(struct Stats_s *dst, const struct Stats_s *src);
+void Stats_Print(FILE *f, const struct Stats_s *s, enum StatsFormat_e format, const struct StatsClock_s *start);
+
+/* _STATS_H_ */
+#endif
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2013-2020 jkbenaim et al.
+ *
+ * This program is free software; you may redistribute and/or modify it under
+ * the terms of the expat license (also known as the "MIT license").
+ *
+ * This program is distributed in the hope that it will be useful, but without
+ * any warranty; without even the implied warranty of merchantability or
+ * firness for a particular purpose.
+ *
+ * For the full license text, see LICENSE.
+ *
+ ******************************************************************************
+ *
+ * This file implements the photo store: encoded images shared by many saves,
+ * each written once under its key, and the manifest in each save's output
+ * directory that lists which of them it holds:
+ *
+ *   slot picture object
+ *
+ */
+
+#include "err_shim.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "store.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define MANIFEST_HEADER "# gbcamextract photos 1"
+
+// More images than this with one key means something is wrong with the
+// hash, not that the store is unlucky.
+#define MAX_SUFFIX 16
+
+static bool makeDir(const char *path)
+{
+#ifdef __MINGW32__
+	if (mkdir(path) == 0 || errno == EEXIST)
+#else
+	if (mkdir(path, 0777) == 0 || errno == EEXIST)
+#endif
+		return true;
+	return false;
+}
+
+static bool writeAll(int fd, const uint8_t *data, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, data, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+// Whether the file at path holds exactly data, read back a block at a time.
+static bool sameContents(const char *path, size_t size, const uint8_t *data, size_t len)
+{
+	uint8_t buf[4096];
+	ssize_t n;
+	int fd;
+
+	if (size != len)
+		return false;
+	fd = open(path, O_RDONLY | O_BINARY);
+	if (fd == -1)
+		return false;
+	while (len) {
+		n = read(fd, buf, len < sizeof(buf) ? len : sizeof(buf));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0 || memcmp(buf, data, n))
+			break;
+		data += n;
+		len -= n;
+	}
+	close(fd);
+	return len == 0;
+}
+
+static void objectName(char *dst, size_t len, uint64_t key, int n, const char *ext)
+{
+	if (n)
+		snprintf(dst, len, "objects/%02x/%016" PRIx64 "-%d.%s", (unsigned)(key >> 56), key, n, ext);
+	else
+		snprintf(dst, len, "objects/%02x/%016" PRIx64 ".%s", (unsigned)(key >> 56), key, ext);
+}
+
+bool Store_Open(struct Store_s *s, const char *dir, bool verify)
+{
+	char path[PATH_MAX];
+
+	memset(s, 0, sizeof(*s));
+	s->dir = dir;
+	s->verify = verify;
+	snprintf(path, sizeof(path), "%s/objects", dir);
+	if (!makeDir(dir) || !makeDir(path)) {
+		warn("couldn't create store '%s'", dir);
+		return false;
+	}
+	return true;
+}
+
+// Whether an image is stored under key. Sets name to its name in the
+// store. Images stored under a suffix after a collision aren't found;
+// only Store_Put with verify tells them apart.
+bool Store_Find(struct Store_s *s, uint64_t key, const char *ext, char *name, size_t nameLen)
+{
+	char path[PATH_MAX];
+	struct stat st;
+
+	objectName(name, nameLen, key, 0, ext);
+	snprintf(path, sizeof(path), "%s/%s", s->dir, name);
+	return !stat(path, &st);
+}
+
+// Store an image under key, unless it is already there. Sets name to its
+// name in the store. A new object is written under a temporary name and
+// renamed into place, so a reader never sees half of one, and two workers
+// storing the same image at once just write it twice.
+bool Store_Put(struct Store_s *s, uint64_t key, const char *ext, const uint8_t *data, size_t len,
+	char *name, size_t nameLen)
+{
+	static unsigned int seq;
+	char path[PATH_MAX], tmp[PATH_MAX + 32];
+	unsigned int fanout = key >> 56;
+	struct stat st;
+	bool ok;
+	int fd;
+
+	for (int n = 0; n < MAX_SUFFIX; ++n) {
+		objectName(name, nameLen, key, n, ext);
+		snprintf(path, sizeof(path), "%s/%s", s->dir, name);
+		if (!stat(path, &st)) {
+			if (!s->verify || sameContents(path, st.st_size, data, len))
+				return true;
+			continue;
+		}
+
+		if (!__atomic_load_n(&s->_made[fanout], __ATOMIC_RELAXED)) {
+			snprintf(tmp, sizeof(tmp), "%s/objects/%02x", s->dir, fanout);
+			if (!makeDir(tmp)) {
+				warn("couldn't create '%s'", tmp);
+				return false;
+			}
+			__atomic_store_n(&s->_made[fanout], 1, __ATOMIC_RELAXED);
+		}
+
+		snprintf(tmp, sizeof(tmp), "%s.%d.%u.tmp", path, (int)getpid(),
+			__atomic_add_fetch(&seq, 1, __ATOMIC_RELAXED));
+		fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+		if (fd == -1) {
+			warn("couldn't open '%s' for writing", tmp);
+			return false;
+		}
+		ok = writeAll(fd, data, len);
+		if (close(fd))
+			ok = false;
+		if (!ok) {
+			warn("couldn't write '%s'", tmp);
+			remove(tmp);
+			return false;
+		}
+		if (rename(tmp, path)) {
+			// On Windows rename won't replace a file, which here means
+			// another worker stored the same image first.
+			bool there = !stat(path, &st);
+			if (!there)
+				warn("couldn't write '%s'", path);
+			remove(tmp);
+			return there;
+		}
+		return true;
+	}
+	warnx("too many images stored under %016" PRIx64, key);
+	return false;
+}
+
+// The manifest is replaced whole, like the state file.
+bool Store_WriteManifest(const struct Store_s *s, const char *dir, const struct StoreRef_s refs[30])
+{
+	char path[PATH_MAX], tmp[PATH_MAX + 32];
+	FILE *f;
+
+	if (*dir)
+		snprintf(path, sizeof(path), "%s/%s", dir, STORE_MANIFEST_NAME);
+	else
+		snprintf(path, sizeof(path), "%s", STORE_MANIFEST_NAME);
+	snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+	if (!(f = fopen(tmp, "w"))) {
+		warn("couldn't write manifest '%s'", tmp);
+		return false;
+	}
+	fprintf(f, MANIFEST_HEADER "\n# store %s\n", s->dir);
+	for (int i = 0; i < 30; ++i)
+		if (*refs[i].name)
+			fprintf(f, "%d %d %s\n", i + 1, refs[i].picture, refs[i].name);
+	if (fclose(f)) {
+		warn("couldn't write manifest '%s'", tmp);
+		remove(tmp);
+		return false;
+	}
+#ifdef __MINGW32__
+	remove(path);
+#endif
+	if (rename(tmp, path)) {
+		warn("couldn't write manifest '%s'", path);
+		remove(tmp);
+		return false;
+	}
+	return true;
+}
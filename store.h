@@ -0,0 +1,41 @@
+#ifndef _STORE_H_
+#define _STORE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define STORE_MANIFEST_NAME "photos.txt"
+#define STORE_NAME_SIZE 48
+
+// A directory of encoded images shared by many saves, each stored once
+// under the 64-bit key of what it was made from:
+//
+//   objects/ab/ab0123456789cdef.png
+//
+// The first byte of the key fans the objects out over 256 directories.
+// Nothing about the objects is kept in memory, so a store can hold any
+// number of them. With verify, an object that is already there is read
+// back and compared; one that differs, because two images had the same
+// key, is stored under the next free suffix (ab0123456789cdef-1.png).
+struct Store_s {
+	const char *dir;
+	bool verify;
+	uint8_t _made[256];	// fan-out directories known to exist
+};
+
+// One line of a save's manifest. An empty name is a slot that wasn't
+// stored.
+struct StoreRef_s {
+	int picture;
+	char name[STORE_NAME_SIZE];
+};
+
+bool Store_Open(struct Store_s *s, const char *dir, bool verify);
+bool Store_Find(struct Store_s *s, uint64_t key, const char *ext, char *name, size_t nameLen);
+bool Store_Put(struct Store_s *s, uint64_t key, const char *ext, const uint8_t *data, size_t len,
+	char *name, size_t nameLen);
+bool Store_WriteManifest(const struct Store_s *s, const char *dir, const struct StoreRef_s refs[30]);
+
+/* _STORE_H_ */
+#endif
@@ -0,0 +1,30 @@
+#!/bin/sh
+# A second incremental run over an unchanged save writes nothing. Run by
+# make check, with the tool and the benchmark (for its synthetic saves).
+#
+# usage: test/incremental.sh gbcamextract gbcambench
+
+set -e
+tool=$1
+bench=$2
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+mkdir "$dir/in"
+"$bench" -g "$dir/in"
+
+# skipped_slots from a run's --stats.
+skipped() {
+	"$tool" "$@" --stats 2>&1 >/dev/null | awk '$1 == "skipped_slots" { print $2 }'
+}
+
+for opts in "" "-T" "-T -f raw2" "-r $dir/in/rom.gb"; do
+	rm -rf "$dir/out"
+	first=$(skipped -i $opts -o "$dir/out" -s "$dir/in/save1.sav")
+	second=$(skipped -i $opts -o "$dir/out" -s "$dir/in/save1.sav")
+	if [ "$first" != 0 ] || [ "$second" != 30 ]; then
+		echo "FAIL: -i $opts: skipped $first then $second slots, expected 0 then 30" >&2
+		exit 1
+	fi
+	echo "ok: -i $opts"
+done
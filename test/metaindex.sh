@@ -0,0 +1,36 @@
+#!/bin/sh
+# The ndjson metadata index stays valid UTF-8 when a save's name isn't: a
+# Latin-1 name is escaped byte by byte, and a UTF-8 one is passed through.
+# Run by make check, with the tool and the benchmark (for its synthetic
+# saves).
+#
+# usage: test/metaindex.sh gbcamextract gbcambench
+
+set -e
+tool=$1
+bench=$2
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+mkdir "$dir/in"
+"$bench" -g "$dir/in"
+
+# "café" in Latin-1, then "naïve" in UTF-8.
+latin1=$(printf 'caf\351.sav')
+utf8=$(printf 'na\303\257ve.sav')
+cp "$dir/in/save1.sav" "$dir/$latin1"
+cp "$dir/in/save1.sav" "$dir/$utf8"
+
+for name in "$latin1" "$utf8"; do
+	case $name in
+	"$latin1") want='/caf\u00e9.sav"' ;;
+	*) want="/$utf8\"" ;;
+	esac
+	"$tool" -m ndjson "$dir/$name" >"$dir/index.json"
+	lines=$(grep -cF "$want" "$dir/index.json" || true)
+	if [ "$lines" != 30 ]; then
+		echo "FAIL: -m ndjson: $lines of 30 records name the save as $want" >&2
+		exit 1
+	fi
+	echo "ok: -m ndjson $want"
+done
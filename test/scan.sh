@@ -0,0 +1,50 @@
+#!/bin/sh
+# -R finds every save in a tree wider than the scan's limit on pending
+# directories (SCAN_MAX_DIRS in scan.h), so the walk has to go depth first
+# partway through. Run by make check, with the tool and the benchmark (for
+# its synthetic saves).
+#
+# usage: test/scan.sh gbcamextract gbcambench
+
+set -e
+tool=$1
+bench=$2
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+mkdir "$dir/in"
+"$bench" -g "$dir/in"
+
+# 5000 directories side by side, with saves at the start, the middle, the
+# end and further down, and a file that isn't a save in every tenth.
+mkdir "$dir/tree"
+i=0
+while [ $i -lt 5000 ]; do
+	mkdir "$dir/tree/d$i"
+	if [ $((i % 10)) = 0 ]; then
+		echo junk > "$dir/tree/d$i/junk.txt"
+	fi
+	i=$((i + 1))
+done
+mkdir -p "$dir/tree/d2500/a/b"
+for d in d0 d2499 d4999 d2500/a/b; do
+	cp "$dir/in/save1.sav" "$dir/tree/$d/cam.sav"
+done
+
+# A line of a run's --stats.
+stat() {
+	awk -v k="$1" '$1 == k { print $2 }' "$dir/stats"
+}
+
+for j in 1 4; do
+	rm -rf "$dir/out"
+	"$tool" -R -j $j -f raw2 -o "$dir/out" --stats "$dir/tree" 2>"$dir/stats"
+	saves=$(stat saves)
+	skipped=$(stat skipped_files)
+	found=$(find "$dir/out" -name cam -type d | wc -l)
+	if [ "$saves" != 4 ] || [ "$skipped" != 500 ] || [ $found != 4 ]; then
+		echo "FAIL: -R -j $j: $saves saves, $found extracted, $skipped skipped, expected 4, 4 and 500" >&2
+		exit 1
+	fi
+	echo "ok: -R -j $j"
+done
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2013-2020 jkbenaim et al.
+ *
+ * This program is free software; you may redistribute and/or modify it under
+ * the terms of the expat license (also known as the "MIT license").
+ *
+ * This program is distributed in the hope that it will be useful, but without
+ * any warranty; without even the implied warranty of merchantability or
+ * firness for a particular purpose.
+ *
+ * For the full license text, see LICENSE.
+ *
+ ******************************************************************************
+ *
+ * This file implements the tile decoder test, run by 'make check'. Every
+ * decoder the CPU can run is given all 65536 pairs of bitplane bytes, and
+ * has to agree with interleaveBytes.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tile.h"
+
+// Wider than a tile, so that a decoder writing past its two bytes a row,
+// or ignoring stride, is caught.
+#define STRIDE 5
+
+static int testDecoder(const char *name)
+{
+	uint8_t tile[16], out[STRIDE * 8];
+	int failures = 0;
+
+	for (unsigned int pair = 0; pair < 65536; pair += 8) {
+		// Eight pairs per tile, one per row.
+		for (int row = 0; row < 8; ++row) {
+			tile[row*2] = pair + row;
+			tile[row*2 + 1] = (pair + row) >> 8;
+		}
+		memset(out, 0xA5, sizeof(out));
+		decodeTile(out, STRIDE, tile);
+		for (int row = 0; row < 8; ++row) {
+			// Shades are inverted, and the leftmost pixels go first.
+			unsigned int want = interleaveBytes(~tile[row*2], ~tile[row*2 + 1]);
+			uint8_t *p = out + row * STRIDE;
+			if (p[0] != (uint8_t)(want >> 8) || p[1] != (uint8_t)want
+			 || p[2] != 0xA5 || p[3] != 0xA5 || p[4] != 0xA5) {
+				if (failures++ < 5)
+					fprintf(stderr, "FAIL: %s: low %02x high %02x: got %02x%02x, expected %04x\n",
+						name, tile[row*2], tile[row*2 + 1], p[0], p[1], want);
+			}
+		}
+	}
+	return failures;
+}
+
+int main(void)
+{
+	static const char *kernels[] = {"sse2", "bmi2", "neon", "scalar"};
+	int tested = 0, failures = 0;
+
+	for (size_t i = 0; i < sizeof(kernels)/sizeof(kernels[0]); ++i) {
+		int n;
+		if (!selectTileDecoder(kernels[i])) {
+			printf("skip: tile %s (not built in, or not supported by this CPU)\n", kernels[i]);
+			continue;
+		}
+		n = testDecoder(kernels[i]);
+		printf("%s: tile %s, 65536 inputs\n", n ? "FAIL" : "ok", kernels[i]);
+		failures += n;
+		tested++;
+	}
+	if (!tested) {
+		fprintf(stderr, "FAIL: no tile decoder could be run\n");
+		return EXIT_FAILURE;
+	}
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
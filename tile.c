@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2013-2020 jkbenaim et al.
+ *
+ * This program is free software; you may redistribute and/or modify it under
+ * the terms of the expat license (also known as the "MIT license").
+ *
+ * This program is distributed in the hope that it will be useful, but without
+ * any warranty; without even the implied warranty of merchantability or
+ * firness for a particular purpose.
+ *
+ * For the full license text, see LICENSE.
+ *
+ ******************************************************************************
+ *
+ * This file implements the 2bpp tile decoder. There is a portable scalar
+ * version plus SIMD versions, and the best one for the running CPU is picked
+ * at startup.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "tile.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TILE_X86
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define TILE_NEON
+#endif
+
+unsigned int interleaveBytes(uint8_t low, uint8_t high)
+{
+	int result;
+	// We recieve two vars, each 8 bits in length
+	// We return one int, 16 bits in length, that contains the two vars interleaved
+	// example:
+	//    low = 00000000
+	//   high = 11111111
+	// result = 10101010 10101010
+
+	result  = low & 1;
+	result |= (high & 1) << 1;
+	result |= (low & 2) << 1;
+	result |= (high & 2) << 2;
+	result |= (low & 4) << 2;
+	result |= (high & 4) << 3;
+	result |= (low & 8) << 3;
+	result |= (high & 8) << 4;
+
+	result |= (low & 16) << 4;
+	result |= (high & 16) << 5;
+	result |= (low & 32) << 5;
+	result |= (high & 32) << 6;
+	result |= (low & 64) << 6;
+	result |= (high & 64) << 7;
+	result |= (low & 128) << 7;
+	result |= (high & 128) << 8;
+
+	return result;
+}
+
+static void decodeTileScalar(uint8_t *p, int stride, const uint8_t *buffer)
+{
+	unsigned int interleaved;
+	uint8_t lowBits, highBits;
+	uint8_t *q;
+	for (q = p + stride * 8; p<q; p+=stride)
+	{
+		lowBits = ~*buffer++;
+		highBits = ~*buffer++;
+		interleaved = interleaveBytes(lowBits, highBits);
+		p[1] = (uint8_t)(interleaved);
+		p[0] = (uint8_t)(interleaved >> 8);
+	}
+}
+
+#ifdef TILE_X86
+// PDEP deposits each bitplane straight into the even or odd bits. It
+// works a row at a time, and is about half as fast as SSE2, which every
+// CPU with BMI2 also has; it is kept as a second reference for the tests
+// and the benchmark, and is never picked at startup.
+__attribute__((target("bmi2")))
+static void decodeTileBmi2(uint8_t *p, int stride, const uint8_t *buffer)
+{
+	unsigned int interleaved;
+	uint8_t *q;
+	for (q = p + stride * 8; p<q; p+=stride, buffer+=2)
+	{
+		interleaved  = _pdep_u32((uint8_t)~buffer[0], 0x5555);
+		interleaved |= _pdep_u32((uint8_t)~buffer[1], 0xAAAA);
+		p[1] = (uint8_t)(interleaved);
+		p[0] = (uint8_t)(interleaved >> 8);
+	}
+}
+
+// The whole tile fits in one register: each 16-bit lane holds one row's
+// low and high byte, which are spread out and merged in place. A tile is
+// 16 bytes, so wider registers (AVX2) would only help by decoding two
+// tiles at a time, and decoding is already a few percent of a slot's time.
+__attribute__((target("sse2")))
+static void decodeTileSse2(uint8_t *p, int stride, const uint8_t *buffer)
+{
+	uint8_t rows[16];
+	__m128i v, lo, hi;
+
+	v = _mm_loadu_si128((const __m128i *)buffer);
+	v = _mm_xor_si128(v, _mm_set1_epi8(-1));
+	lo = _mm_and_si128(v, _mm_set1_epi16(0x00FF));
+	hi = _mm_srli_epi16(v, 8);
+
+	lo = _mm_and_si128(_mm_or_si128(lo, _mm_slli_epi16(lo, 4)), _mm_set1_epi16(0x0F0F));
+	hi = _mm_and_si128(_mm_or_si128(hi, _mm_slli_epi16(hi, 4)), _mm_set1_epi16(0x0F0F));
+	lo = _mm_and_si128(_mm_or_si128(lo, _mm_slli_epi16(lo, 2)), _mm_set1_epi16(0x3333));
+	hi = _mm_and_si128(_mm_or_si128(hi, _mm_slli_epi16(hi, 2)), _mm_set1_epi16(0x3333));
+	lo = _mm_and_si128(_mm_or_si128(lo, _mm_slli_epi16(lo, 1)), _mm_set1_epi16(0x5555));
+	hi = _mm_and_si128(_mm_or_si128(hi, _mm_slli_epi16(hi, 1)), _mm_set1_epi16(0x5555));
+	v = _mm_or_si128(lo, _mm_slli_epi16(hi, 1));
+
+	// Leftmost pixels go in the first byte.
+	v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+	_mm_storeu_si128((__m128i *)rows, v);
+	for (int i = 0; i < 8; ++i, p += stride)
+		memcpy(p, rows + i*2, 2);
+}
+#endif
+
+#ifdef TILE_NEON
+static void decodeTileNeon(uint8_t *p, int stride, const uint8_t *buffer)
+{
+	uint8_t rows[16];
+	uint16x8_t v, lo, hi;
+
+	v = vreinterpretq_u16_u8(vmvnq_u8(vld1q_u8(buffer)));
+	lo = vandq_u16(v, vdupq_n_u16(0x00FF));
+	hi = vshrq_n_u16(v, 8);
+
+	lo = vandq_u16(vorrq_u16(lo, vshlq_n_u16(lo, 4)), vdupq_n_u16(0x0F0F));
+	hi = vandq_u16(vorrq_u16(hi, vshlq_n_u16(hi, 4)), vdupq_n_u16(0x0F0F));
+	lo = vandq_u16(vorrq_u16(lo, vshlq_n_u16(lo, 2)), vdupq_n_u16(0x3333));
+	hi = vandq_u16(vorrq_u16(hi, vshlq_n_u16(hi, 2)), vdupq_n_u16(0x3333));
+	lo = vandq_u16(vorrq_u16(lo, vshlq_n_u16(lo, 1)), vdupq_n_u16(0x5555));
+	hi = vandq_u16(vorrq_u16(hi, vshlq_n_u16(hi, 1)), vdupq_n_u16(0x5555));
+	v = vorrq_u16(lo, vshlq_n_u16(hi, 1));
+
+	// Leftmost pixels go in the first byte.
+	vst1q_u8(rows, vrev16q_u8(vreinterpretq_u8_u16(v)));
+	for (int i = 0; i < 8; ++i, p += stride)
+		memcpy(p, rows + i*2, 2);
+}
+#endif
+
+// Fastest first. Those that aren't picked can still be selected by name.
+static const struct {
+	const char *name;
+	void (*fn)(uint8_t *, int, const uint8_t *);
+	bool picked;
+} decoders[] = {
+#ifdef TILE_X86
+	{"sse2", decodeTileSse2, true},
+	{"bmi2", decodeTileBmi2, false},
+#endif
+#ifdef TILE_NEON
+	{"neon", decodeTileNeon, true},
+#endif
+	{"scalar", decodeTileScalar, true},
+};
+
+void (*decodeTile)(uint8_t *dst, int stride, const uint8_t tile[16]) = decodeTileScalar;
+
+static bool cpuSupports(const char *name)
+{
+#ifdef TILE_X86
+	__builtin_cpu_init();
+	if (!strcmp(name, "sse2"))
+		return __builtin_cpu_supports("sse2");
+	if (!strcmp(name, "bmi2"))
+		return __builtin_cpu_supports("bmi2");
+#endif
+	return true;
+}
+
+const char *tileDecoderName(void)
+{
+	for (size_t i = 0; i < sizeof(decoders)/sizeof(decoders[0]); ++i)
+		if (decoders[i].fn == decodeTile)
+			return decoders[i].name;
+	return "unknown";
+}
+
+// Switch to the named decoder. Fails if it isn't built in or the CPU can't
+// run it.
+bool selectTileDecoder(const char *name)
+{
+	for (size_t i = 0; i < sizeof(decoders)/sizeof(decoders[0]); ++i)
+		if (!strcmp(decoders[i].name, name)) {
+			if (!cpuSupports(name))
+				return false;
+			decodeTile = decoders[i].fn;
+			return true;
+		}
+	return false;
+}
+
+__attribute__((constructor))
+static void pickTileDecoder(void)
+{
+	for (size_t i = 0; i < sizeof(decoders)/sizeof(decoders[0]); ++i)
+		if (decoders[i].picked && selectTileDecoder(decoders[i].name))
+			return;
+}
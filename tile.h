@@ -0,0 +1,17 @@
+#ifndef _TILE_H_
+#define _TILE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Decode one 8x8 2bpp Game Boy tile (16 bytes, low/high bitplane pairs)
+// into eight rows of packed 2-bit pixels, stride bytes apart. Shades are
+// inverted so that 0 is black, as PNG grayscale expects.
+extern void (*decodeTile)(uint8_t *dst, int stride, const uint8_t tile[16]);
+
+unsigned int interleaveBytes(uint8_t low, uint8_t high);
+const char *tileDecoderName(void);
+bool selectTileDecoder(const char *name);
+
+/* _TILE_H_ */
+#endif
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2013-2020 jkbenaim et al.
+ *
+ * This program is free software; you may redistribute and/or modify it under
+ * the terms of the expat license (also known as the "MIT license").
+ *
+ * This program is distributed in the hope that it will be useful, but without
+ * any warranty; without even the implied warranty of merchantability or
+ * firness for a particular purpose.
+ *
+ * For the full license text, see LICENSE.
+ *
+ ******************************************************************************
+ *
+ * This file implements save verification. The camera keeps two copies of
+ * the album order and of each slot's image and user metadata, each ending
+ * in "Magic" and a two-byte checksum.
+ *
+ * The checksum is as documented by people who have taken the format apart:
+ * the first byte is the sum of the block's bytes plus 0x2f, and the second
+ * is the XOR of all of them with 0x15, both taken over the block up to and
+ * including "Magic". This hasn't been checked against every camera
+ * revision, which is why a block whose checksum fails but whose two copies
+ * agree is reported as unverified rather than bad.
+ *
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "gbcam.h"
+#include "sram.h"
+
+// Sum and parity of a block, eight bytes at a time.
+static void sumXor(const uint8_t *p, size_t len, uint8_t *sum, uint8_t *parity)
+{
+	uint64_t sums = 0, xors = 0, w;
+	uint8_t s = 0, x = 0;
+
+	for (; len >= 8; p += 8, len -= 8) {
+		memcpy(&w, p, 8);
+		xors ^= w;
+		// Add byte lanes in pairs into 16-bit lanes, which can't overflow
+		// for the blocks here (at most 0x5a bytes).
+		sums += (w & 0x00ff00ff00ff00ffULL) + ((w >> 8) & 0x00ff00ff00ff00ffULL);
+	}
+	sums += sums >> 32;
+	sums += sums >> 16;
+	s = sums;
+	xors ^= xors >> 32;
+	xors ^= xors >> 16;
+	xors ^= xors >> 8;
+	x = xors;
+	for (; len; --len, ++p) {
+		s += *p;
+		x ^= *p;
+	}
+	*sum = s;
+	*parity = x;
+}
+
+// A block is its data up to and including "Magic", then the checksum.
+static void checkBlock(struct GbCam_BlockCheck_s *c, const uint8_t *block, size_t len)
+{
+	uint8_t sum, parity;
+
+	sumXor(block, len, &sum, &parity);
+	c->magic = !memcmp(block + len - 5, "Magic", 5);
+	c->checksum = block[len] == (uint8_t)(0x2f + sum) && block[len + 1] == (0x15 ^ parity);
+}
+
+static enum GbCam_Trust_e checkPair(struct GbCam_BlockCheck_s c[2], bool *copiesMatch,
+	const uint8_t *primary, const uint8_t *backup, size_t len)
+{
+	checkBlock(&c[0], primary, len);
+	checkBlock(&c[1], backup, len);
+	*copiesMatch = !memcmp(primary, backup, len + 2);
+	if (c[0].magic && c[0].checksum)
+		return *copiesMatch ? GBCAM_TRUST_OK : GBCAM_TRUST_PRIMARY;
+	if (c[1].magic && c[1].checksum)
+		return GBCAM_TRUST_BACKUP;
+	if (c[0].magic && *copiesMatch)
+		return GBCAM_TRUST_UNVERIFIED;
+	return GBCAM_TRUST_BAD;
+}
+
+static enum GbCam_Trust_e worse(enum GbCam_Trust_e a, enum GbCam_Trust_e b)
+{
+	return a > b ? a : b;
+}
+
+// The photo data itself has no checksum, so a slot is only as trustworthy
+// as its metadata.
+int GbCam_VerifySave(const struct GbCam_Save_s *save, struct GbCam_Report_s *r)
+{
+	const struct firstslot_s *first;
+
+	if (!save || !r)
+		return GBCAM_EINVAL;
+	memset(r, 0, sizeof(*r));
+	first = (const struct firstslot_s *)save->data;
+	r->album = checkPair(r->albumChecks, &r->albumCopiesMatch,
+		first->vec, first->vec2, offsetof(struct firstslot_s, checksum) - offsetof(struct firstslot_s, vec));
+
+	for (int i = 0; i < GBCAM_NUM_SLOTS; ++i) {
+		const struct slot_s *slot = (const struct slot_s *)(save->data + (i + 2) * 0x1000);
+		struct GbCam_SlotReport_s *s = &r->slots[i];
+
+		s->image = checkPair(s->imageChecks, &s->imageCopiesMatch,
+			(const uint8_t *)&slot->imagemeta, (const uint8_t *)&slot->imagemeta2,
+			offsetof(struct image_metadata_s, checksum));
+		s->user = checkPair(s->userChecks, &s->userCopiesMatch,
+			(const uint8_t *)&slot->usermeta, (const uint8_t *)&slot->usermeta2,
+			offsetof(struct user_metadata_s, checksum));
+		s->trust = worse(s->image, s->user);
+		r->counts[s->trust]++;
+	}
+	return GBCAM_OK;
+}
+
+const char *GbCam_TrustName(enum GbCam_Trust_e trust)
+{
+	switch (trust) {
+	case GBCAM_TRUST_OK:		return "ok";
+	case GBCAM_TRUST_PRIMARY:	return "backup differs";
+	case GBCAM_TRUST_BACKUP:	return "primary bad, backup ok";
+	case GBCAM_TRUST_UNVERIFIED:	return "unverified";
+	case GBCAM_TRUST_BAD:		return "bad";
+	default:			return "unknown";
+	}
+}
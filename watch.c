@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2013-2020 jkbenaim et al.
+ *
+ * This program is free software; you may redistribute and/or modify it under
+ * the terms of the expat license (also known as the "MIT license").
+ *
+ * This program is distributed in the hope that it will be useful, but without
+ * any warranty; without even the implied warranty of merchantability or
+ * firness for a particular purpose.
+ *
+ * For the full license text, see LICENSE.
+ *
+ ******************************************************************************
+ *
+ * This file implements watch mode's wait for a save to change, with inotify.
+ *
+ */
+
+#ifdef __linux__
+
+#include "err_shim.h"
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include "watch.h"
+
+#define WATCH_EVENTS (IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE)
+
+bool Watch_Open(struct Watch_s *w, const char *path)
+{
+	char dir[PATH_MAX];
+	const char *slash = strrchr(path, '/');
+
+	if (slash) {
+		snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path) + (slash == path), path);
+		snprintf(w->name, sizeof(w->name), "%s", slash + 1);
+	} else {
+		snprintf(dir, sizeof(dir), ".");
+		snprintf(w->name, sizeof(w->name), "%s", path);
+	}
+
+	w->fd = inotify_init1(IN_CLOEXEC);
+	if (w->fd == -1) {
+		warn("couldn't start watching '%s'", path);
+		return false;
+	}
+	if (inotify_add_watch(w->fd, dir, WATCH_EVENTS) == -1) {
+		warn("couldn't watch '%s'", dir);
+		close(w->fd);
+		return false;
+	}
+	return true;
+}
+
+// Reads the pending events. Returns -1 on error, 0 if none were about the
+// file, 1 if the file changed and may still be being written, and 2 if the
+// last event was the writer closing it or renaming it into place.
+static int readEvents(struct Watch_s *w)
+{
+	uint8_t buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t n;
+	int state = 0;
+
+	n = read(w->fd, buf, sizeof(buf));
+	if (n <= 0)
+		return (n < 0 && errno == EINTR) ? 0 : -1;
+	for (uint8_t *p = buf; p < buf + n; ) {
+		const struct inotify_event *e = (const struct inotify_event *)p;
+		if (e->len && !strcmp(e->name, w->name))
+			state = (e->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) ? 2 : 1;
+		p += sizeof(*e) + e->len;
+	}
+	return state;
+}
+
+// Blocks until the file has been written and then left alone for
+// debounceMs, or closed by its writer, whichever comes first.
+bool Watch_Wait(struct Watch_s *w, int debounceMs)
+{
+	struct pollfd pfd = {.fd = w->fd, .events = POLLIN};
+	int state = 0, r;
+
+	while (!state)
+		if ((state = readEvents(w)) == -1)
+			return false;
+
+	for (;;) {
+		r = poll(&pfd, 1, state == 2 ? 0 : debounceMs);
+		if (r < 0 && errno != EINTR)
+			return false;
+		if (r <= 0)
+			return true;
+		if ((r = readEvents(w)) == -1)
+			return false;
+		if (r)
+			state = r;
+	}
+}
+
+void Watch_Close(struct Watch_s *w)
+{
+	close(w->fd);
+}
+
+/* __linux__ */
+#endif
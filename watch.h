@@ -0,0 +1,20 @@
+#ifndef _WATCH_H_
+#define _WATCH_H_
+
+#include <limits.h>
+#include <stdbool.h>
+
+// Waits for a file to be written. The file's directory is watched rather
+// than the file, so writers that replace the file by renaming over it are
+// seen too.
+struct Watch_s {
+	int fd;
+	char name[NAME_MAX + 1];
+};
+
+bool Watch_Open(struct Watch_s *w, const char *path);
+bool Watch_Wait(struct Watch_s *w, int debounceMs);
+void Watch_Close(struct Watch_s *w);
+
+/* _WATCH_H_ */
+#endif